@@ -2,6 +2,7 @@
 #ifndef BLOOM_H
 #define BLOOM_H
 
+#include <cmath>
 #include <vector>
 
 #include "global.hpp"
@@ -47,6 +48,22 @@ vec3 up_sample(const vec2 &uv, const Texture<vec3> &sampler_tex) {
     return sum;
 }
 
+// Return the number of rows read above and below each pixel through the
+// pyramid. The pixels of the pyramids of bands of the frame are aligned with
+// the pyramid of the frame if the bands start at multiples of
+// 2^blur_iteration rows.
+int halo(const float blur_radius, const int blur_iteration) {
+    float offset = 1.f + blur_radius;
+    float halo = 0;
+    for (int i = 1; i <= blur_iteration; i++) {
+        // down_sample() of level i reads level i - 1
+        halo += (offset + 1.f) * (1 << (i - 1));
+        // up_sample() of level i - 1 reads level i
+        halo += (offset + 2.f) * (1 << (i - 1));
+    }
+    return std::ceil(halo);
+}
+
 Texture<vec3> bloom_filter(const Texture<vec3> &orig_frame,
                            const float strength, const float blur_radius,
                            const int blur_iteration) {
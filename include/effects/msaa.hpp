@@ -5,15 +5,25 @@
 #include <array>
 
 #include "global.hpp"
+#include "texture/compressed_msaa_texture.hpp"
 #include "texture/texture.hpp"
 
 extern "C++" {
 
 namespace msaa {
 
-const size_t MSAA_LEVEL = 4;
+// Maximum number of samples per pixel, limited by the 8-bit coverage flags.
+const size_t MAX_MSAA_LEVEL = 8;
 
-template <typename T>
+enum SamplePattern {
+    // samples on an axis-aligned grid
+    GRID,
+    // samples on a rotated grid, which resolves near-horizontal and
+    // near-vertical edges better
+    ROTATED
+};
+
+template <typename T, size_t MSAA_LEVEL>
 Texture<T> msaa_filter(const Texture<bool> &full_covered,
                        const Texture<std::array<T, MSAA_LEVEL>> &src) {
     static_assert(std::is_same_v<T, float> || std::is_same_v<T, vec3>);
@@ -44,33 +54,72 @@ Texture<T> msaa_filter(const Texture<bool> &full_covered,
     return res;
 }
 
-template <typename T>
+template <typename T, size_t MSAA_LEVEL>
+Texture<T> msaa_filter(const CompressedMsaaTexture<T, MSAA_LEVEL> &src) {
+    Texture<T> res(src.width, src.height);
+
+#pragma omp parallel for
+    for (size_t y = 0; y < src.height; y++) {
+        for (size_t x = 0; x < src.width; x++) {
+            if (src.is_uniform(x, y)) {
+                res.at(x, y) = src.sample(x, y, 0);
+            } else {
+                // average
+                T sum = src.sample(x, y, 0);
+                for (size_t i = 1; i < MSAA_LEVEL; i++) {
+                    sum += src.sample(x, y, i);
+                }
+                res.at(x, y) = sum / MSAA_LEVEL;
+            }
+        }
+    }
+
+    return res;
+}
+
+template <size_t MSAA_LEVEL, typename T>
 std::array<T, MSAA_LEVEL> texture_init_val(const T &val) {
-    std::array<T, msaa::MSAA_LEVEL> ret;
+    std::array<T, MSAA_LEVEL> ret;
     for (auto &v : ret) {
         v = val;
     }
     return ret;
 }
 
-// * samples_coord_delta
+// Return the relative position of the sampling points.
 // * center: the left top corner of the pixel
-
-// * MSAA 4x
-const vec2 samples_coord_delta[MSAA_LEVEL] = {
-    vec2(0.25, 0.25), vec2(0.75, 0.25), vec2(0.25, 0.75), vec2(0.75, 0.75)};
-
-// * MSAA 4x (rotated sampling points)
-// const vec2 samples_coord_delta[MSAA_LEVEL] = {
-//     vec2(0.5915063509461, 0.1584936490539),
-//     vec2(0.1584936490539, 0.4084936490539),
-//     vec2(0.8415063509461, 0.5915063509461),
-//     vec2(0.4084936490539, 0.8415063509461)};
-
-// * MSAA OFF
-// const vec2 samples_coord_delta[MSAA_LEVEL] = {vec2(0.5, 0.5)};
+template <size_t MSAA_LEVEL>
+std::array<vec2, MSAA_LEVEL> samples_coord_delta(const SamplePattern pattern) {
+    static_assert(MSAA_LEVEL == 1 || MSAA_LEVEL == 2 || MSAA_LEVEL == 4 ||
+                  MSAA_LEVEL == 8);
+
+    if constexpr (MSAA_LEVEL == 1) {  // MSAA OFF
+        return {vec2(0.5, 0.5)};
+    } else if constexpr (MSAA_LEVEL == 2) {  // MSAA 2x
+        return {vec2(0.25, 0.25), vec2(0.75, 0.75)};
+    } else if constexpr (MSAA_LEVEL == 4) {  // MSAA 4x
+        if (pattern == ROTATED) {
+            return {vec2(0.5915063509461, 0.1584936490539),
+                    vec2(0.1584936490539, 0.4084936490539),
+                    vec2(0.8415063509461, 0.5915063509461),
+                    vec2(0.4084936490539, 0.8415063509461)};
+        }
+        return {vec2(0.25, 0.25), vec2(0.75, 0.25), vec2(0.25, 0.75),
+                vec2(0.75, 0.75)};
+    } else {  // MSAA 8x
+        if (pattern == ROTATED) {
+            return {vec2(0.5625, 0.3125), vec2(0.4375, 0.6875),
+                    vec2(0.8125, 0.5625), vec2(0.3125, 0.1875),
+                    vec2(0.1875, 0.8125), vec2(0.0625, 0.4375),
+                    vec2(0.6875, 0.9375), vec2(0.9375, 0.0625)};
+        }
+        return {vec2(0.125, 0.25), vec2(0.375, 0.25), vec2(0.625, 0.25),
+                vec2(0.875, 0.25), vec2(0.125, 0.75), vec2(0.375, 0.75),
+                vec2(0.625, 0.75), vec2(0.875, 0.75)};
+    }
+}
 
 }  // namespace msaa
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -19,7 +19,8 @@ class OutlineVertexShader : public VertexShader {
     vec3 camera_pos;
 
     OutlineVertexShader(const Camera &camera);
-    void shade(Vertex *vertex);
+    // Return the position moved outwards along the smooth normal.
+    vec3 shade(const vec3 &pos, const vec3 &smooth_normal) const;
 };
 
 class OutlineFragmentShader : public FragmentShader {
@@ -2,11 +2,15 @@
 #ifndef RIMLIGHT_H
 #define RIMLIGHT_H
 
+#include <algorithm>
+#include <cstdlib>
 #include <vector>
 
 #include "effects/msaa.hpp"
 #include "global.hpp"
+#include "rasterizer/tile.hpp"
 #include "scene/camera.hpp"
+#include "texture/buffer.hpp"
 #include "texture/texture.hpp"
 #include "utils/functions.hpp"
 
@@ -16,38 +20,82 @@ namespace rimlight {
 const std::vector<std::tuple<size_t, size_t, float>> RIMLIGHT_DELTA = {
     {-8, 0, 1.2}, {8, 0, 1.2}};
 
+// Return the number of rows read above and below each pixel.
+int halo() {
+    int halo = 0;
+    for (auto [dx, dy, intensity] : RIMLIGHT_DELTA) {
+        halo = std::max(halo, std::abs(static_cast<int>(dy)));
+    }
+    return halo;
+}
+
 float calc_depth(const vec3 &pos, const Camera &camera) {
     return (pos - camera.pos).norm();
 }
 
-void rimlight(Buffer *buffer, const Camera &camera) {
-#pragma omp parallel for
-    for (size_t y = 0; y < buffer->pos_buffer->height; y++) {
-        for (size_t x = 0; x < buffer->pos_buffer->width; x++) {
-            for (size_t i = 0; i < msaa::MSAA_LEVEL; i++) {
-                if (buffer->z_buffer->at(x, y)[i] > 1.f - EPS)
-                    continue;  // at background
-
-                float depth =
-                    calc_depth(buffer->pos_buffer->at(x, y)[i], camera);
-
-                // for each sample
-                for (auto [dx, dy, intensity] : RIMLIGHT_DELTA) {
-                    size_t tx = x + dx;
-                    size_t ty = y + dy;
-
-                    if ((tx < 0 || tx >= buffer->z_buffer->width) ||
-                        (ty < 0 || ty >= buffer->z_buffer->height))
-                        continue;
-
-                    // do depth test if the sample is not at the background
-                    if (buffer->z_buffer->at(tx, ty)[i] <= 1.f - EPS) {
-                        float t_depth = calc_depth(
-                            buffer->pos_buffer->at(tx, ty)[i], camera);
-                        if (t_depth - depth < 1.f) continue;
+template <size_t MSAA_LEVEL>
+void rimlight(Buffer<MSAA_LEVEL> *buffer, const Camera &camera) {
+    auto frame_buffer = buffer->frame_buffer.get();
+
+    // each band of tile rows is written by a single thread, see
+    // CompressedMsaaTexture
+#pragma omp parallel for schedule(dynamic)
+    for (size_t band_y = 0; band_y < frame_buffer->height;
+         band_y += tile::TILE_SIZE) {
+        size_t band_max_y =
+            std::min<size_t>(band_y + tile::TILE_SIZE, frame_buffer->height);
+        for (size_t y = band_y; y < band_max_y; y++) {
+            for (size_t x = 0; x < frame_buffer->width; x++) {
+                // rimlight intensity of each sample
+                float factor[MSAA_LEVEL];
+                for (size_t i = 0; i < MSAA_LEVEL; i++) {
+                    factor[i] = 1.f;
+                    if (buffer->background_flag->at(x, y) & (1u << i))
+                        continue;  // at background
+
+                    float depth = calc_depth(
+                        buffer->pos_buffer->sample(x, y, i), camera);
+
+                    // for each sample
+                    for (auto [dx, dy, intensity] : RIMLIGHT_DELTA) {
+                        size_t tx = x + dx;
+                        size_t ty = y + dy;
+
+                        if ((tx < 0 || tx >= frame_buffer->width) ||
+                            (ty < 0 || ty >= frame_buffer->height))
+                            continue;
+
+                        // do depth test if the sample is not at the
+                        // background
+                        if (!(buffer->background_flag->at(tx, ty) &
+                              (1u << i))) {
+                            float t_depth = calc_depth(
+                                buffer->pos_buffer->sample(tx, ty, i), camera);
+                            if (t_depth - depth < 1.f) continue;
+                        }
+
+                        factor[i] *= intensity;
                     }
+                }
 
-                    buffer->frame_buffer->at(x, y)[i] *= intensity;
+                // keep the pixel uniform if all samples are lit equally
+                if (frame_buffer->is_uniform(x, y) &&
+                    std::all_of(factor, factor + MSAA_LEVEL,
+                                [&](float f) { return f == factor[0]; })) {
+                    if (factor[0] != 1.f) {
+                        frame_buffer->write(
+                            x, y, (1u << MSAA_LEVEL) - 1,
+                            frame_buffer->sample(x, y, 0) * factor[0]);
+                    }
+                    continue;
+                }
+
+                for (size_t i = 0; i < MSAA_LEVEL; i++) {
+                    if (factor[i] != 1.f) {
+                        frame_buffer->write(
+                            x, y, 1u << i,
+                            frame_buffer->sample(x, y, i) * factor[i]);
+                    }
                 }
             }
         }
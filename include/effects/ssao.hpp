@@ -5,9 +5,9 @@
 #include <algorithm>
 #include <cmath>
 #include <opencv2/opencv.hpp>
+#include <tuple>
 
 #include "effects/msaa.hpp"
-#include "geometry/vertex.hpp"
 #include "global.hpp"
 #include "shader/vertex_shader.hpp"
 #include "texture/buffer.hpp"
@@ -20,6 +20,12 @@ namespace ssao {
 const size_t SAMPLES_NUM = 32;
 const float SAMPLE_RADIUS = 0.05;
 
+// maximum distance of the samples from the fragment, see ssao_filter()
+const float MAX_SAMPLE_DIST = .1f + .9f * SAMPLE_RADIUS * SAMPLE_RADIUS;
+
+// diameter of the bilateral filter of the occlusion
+const int BLUR_DIAMETER = 10;
+
 // return noise between [0, 1]
 float random(const float st1, const float st2) {
     return fract(sin(st1 * 114 + st2 * 514) * 19198.10);
@@ -29,9 +35,27 @@ float random(const float st1, const float st2, const float st3) {
     return fract(sin(st1 * 114.5 + st2 * 141.1 + st3 * 451.4) * 19198.10);
 }
 
-Texture<vec3> ssao_filter(Buffer *buffer, const Texture<vec3> &frame_buffer,
+// Return the number of rows read above and below each pixel, for the
+// fragments at least `min_w` away from the camera.
+int halo(const Camera &camera, const float min_w) {
+    // the farthest sample projected from the nearest fragment
+    float sample_w = min_w - MAX_SAMPLE_DIST;
+    if (!(sample_w > 0)) return camera.frame_height;
+    float focal = camera.frame_height / 2.f / std::tan(camera.fov / 2.f);
+    // a sample is at most 1 / cos(fov / 2) farther from the fragment off the
+    // view axis, at the top and bottom edges of the frame
+    float sample_dy =
+        MAX_SAMPLE_DIST * focal / sample_w / std::cos(camera.fov / 2.f);
+    return std::min<int>(std::ceil(sample_dy) + 1, camera.frame_height) +
+           BLUR_DIAMETER / 2;
+}
+
+// * offset_y: row of the frame at y = 0 of the buffers, see Camera::band()
+template <size_t MSAA_LEVEL>
+Texture<vec3> ssao_filter(Buffer<MSAA_LEVEL> *buffer,
+                          const Texture<vec3> &frame_buffer,
                           const Texture<float> &z_buffer,
-                          VertexShader *vertex_shader) {
+                          VertexShader *vertex_shader, const int offset_y = 0) {
     auto ao_texture =
         cv::Mat(frame_buffer.height, frame_buffer.width, CV_32FC1);
 
@@ -53,15 +77,16 @@ Texture<vec3> ssao_filter(Buffer *buffer, const Texture<vec3> &frame_buffer,
             float occlusion = 0.f;
 
             // for each MSAA sample
-            for (size_t i = 0; i < msaa::MSAA_LEVEL; i++) {
-                // generate a random base tangent
-                vec3 tangent =
-                    vec3(random(x, y, i * 2) * 2.f - 1.f,      // x: [-1, 1]
-                         random(x, y, i * 2 + 1) * 2.f - 1.f,  // y: [-1, 1]
-                         0);                                   // z: 0
+            for (size_t i = 0; i < MSAA_LEVEL; i++) {
+                // generate a random base tangent, seeded by the position in
+                // the frame
+                size_t frame_y = y + offset_y;
+                float tangent_x = random(x, frame_y, i * 2) * 2.f - 1.f;
+                float tangent_y = random(x, frame_y, i * 2 + 1) * 2.f - 1.f;
+                vec3 tangent = vec3(tangent_x, tangent_y, 0);  // [-1, 1]
 
                 mat3 tbn;
-                vec3 n = buffer->normal_buffer->at(x, y)[i];
+                vec3 n = buffer->normal_buffer->sample(x, y, i);
                 vec3 t = (tangent - tangent.dot(n) * n).normalized();
                 vec3 b = t.cross(n);
 
@@ -72,29 +97,27 @@ Texture<vec3> ssao_filter(Buffer *buffer, const Texture<vec3> &frame_buffer,
                 // clang-format on
                 tbn.transposeInPlace();
 
-                if (buffer->z_buffer->at(x, y)[i] >=
-                    1.f - EPS)  // at the backgound
-                    continue;
+                if (buffer->background_flag->at(x, y) & (1u << i))
+                    continue;  // at the backgound
 
-                vec3 fragment_pos = buffer->pos_buffer->at(x, y)[i];
-                Vertex fragment_vertex = Vertex(fragment_pos);
-                vertex_shader->shade(&fragment_vertex);
-                float fragment_z = fragment_vertex.screen_pos.z();
+                vec3 fragment_pos = buffer->pos_buffer->sample(x, y, i);
+                vec3 fragment_screen_pos =
+                    std::get<0>(vertex_shader->shade(fragment_pos));
+                float fragment_z = fragment_screen_pos.z();
 
                 // each sample
                 for (size_t j = 0; j < SAMPLES_NUM; j++) {
                     // transform to tangent space
                     vec3 sample_pos = fragment_pos + tbn * samples[j];
 
-                    Vertex sample_vertex = Vertex(sample_pos);
-                    vertex_shader->shade(&sample_vertex);
-                    vec2 sample_uv =
-                        vec2(sample_vertex.screen_pos.x() / frame_buffer.width,
-                             1.f - sample_vertex.screen_pos.y() /
-                                       frame_buffer.height);
-
-                    float sample_z = sample_vertex.screen_pos.z();
-                    float buffer_z = z_buffer.sample_no_repeat(sample_uv);
+                    // sampled by the pixel position rather than the uv, so
+                    // that a band reads the same depth as the whole frame
+                    vec3 sample_screen_pos =
+                        std::get<0>(vertex_shader->shade(sample_pos));
+                    float sample_z = sample_screen_pos.z();
+                    float buffer_z = z_buffer.sample_no_repeat(
+                        sample_screen_pos.x(),
+                        sample_screen_pos.y() - offset_y);
 
                     if (sample_z > buffer_z + EPS) {  // if occluted
                         occlusion += smoothstep(
@@ -111,7 +134,7 @@ Texture<vec3> ssao_filter(Buffer *buffer, const Texture<vec3> &frame_buffer,
             }
 
             if (!buffer->full_covered->at(x, y)) {
-                occlusion /= msaa::MSAA_LEVEL;
+                occlusion /= MSAA_LEVEL;
             }
 
             occlusion /= SAMPLES_NUM;
@@ -122,7 +145,7 @@ Texture<vec3> ssao_filter(Buffer *buffer, const Texture<vec3> &frame_buffer,
 
     cv::UMat ao_texture_src = ao_texture.getUMat(cv::ACCESS_READ);
     cv::UMat ao_texture_dst;
-    cv::bilateralFilter(ao_texture_src, ao_texture_dst, 10, 0.1, 10);
+    cv::bilateralFilter(ao_texture_src, ao_texture_dst, BLUR_DIAMETER, 0.1, 10);
     cv::Mat ao_texture_blurred = ao_texture_dst.getMat(cv::ACCESS_READ);
 
     auto result = Texture<vec3>(frame_buffer.width, frame_buffer.height);
@@ -0,0 +1,77 @@
+#pragma once
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <cstddef>
+
+#include "geometry/triangle.hpp"
+#include "global.hpp"
+#include "scene/camera.hpp"
+
+namespace cluster {
+// Maximum number of triangles in a cluster. A shape is split into clusters of
+// equal size, so a cluster of a large shape has more than half as many.
+const size_t MAX_TRIANGLES = 128;
+
+// Margins of the culling tests against the rounding errors, relative to the
+// distance from the camera for the frustum, and in radians for the cone.
+const float DISTANCE_MARGIN = 1e-4f;
+const float ANGLE_MARGIN = 1e-3f;
+}  // namespace cluster
+
+// Planes of the view frustum of a camera in the world space, at the bounds of
+// Triangle::is_culled_view().
+class Frustum {
+   private:
+    // a point p is inside the plane k if normals[k].dot(p) + offsets[k] >= 0,
+    // with the normals normalized
+    vec3 normals[6];
+    float offsets[6];
+    vec3 camera_pos;
+
+   public:
+    Frustum(const Camera &camera);
+
+    // Return if the sphere is entirely outside one of the planes.
+    bool is_outside(const vec3 &center, const float radius) const;
+};
+
+// Bounding sphere of the vertices of a cluster, and the cone containing their
+// normals.
+class ClusterBounds {
+   public:
+    vec3 center = vec3(0, 0, 0);
+    float radius = 0;
+
+    // all vertex normals are within `cone_angle` radians of `cone_axis`, only
+    // if `has_cone`, i.e. all triangles have normals
+    bool has_cone = false;
+    vec3 cone_axis = vec3(0, 0, 0);
+    float cone_angle = 0;
+
+    ClusterBounds();
+
+    // Bounds of the object-space vertices of the triangles [first, first +
+    // size).
+    ClusterBounds(const Triangle *first, const size_t size);
+
+    // Return if all triangles in the bounds are culled by
+    // Triangle::is_culled(), as the sphere is outside the frustum, or all
+    // normals in the cone face the culled side from all points in the sphere.
+    bool is_culled(const Frustum &frustum, const Camera &camera,
+                   Triangle::CullMethod cull_method) const;
+};
+
+// Consecutive triangles of a shape, culled as a whole before any
+// per-triangle test.
+class Cluster {
+   public:
+    // triangles [first, first + size) of the object
+    size_t first = 0;
+    size_t size = 0;
+
+    // object-space bounds
+    ClusterBounds bounds;
+};
+
+#endif
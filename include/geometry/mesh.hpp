@@ -0,0 +1,69 @@
+#pragma once
+#ifndef MESH_H
+#define MESH_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "global.hpp"
+#include "scene/material.hpp"
+
+// Indexed triangle mesh, with each vertex attribute in a contiguous array.
+//
+// A vertex is a distinct combination of a position, a normal and a texcoord
+// used by the faces, so that a triangle is three indices into the same
+// arrays. The vertices without a normal or a texcoord hold zero in it.
+class Mesh {
+   public:
+    static const uint32_t NO_MATERIAL = UINT32_MAX;
+
+    // object-space attributes of the vertices, not modified after loading
+    std::vector<vec3> positions;
+    std::vector<vec3> normals;
+    std::vector<vec2> texcoords;
+    // normal of the position, averaged over the normals of all faces using
+    // it, and shared by all vertices at the position, e.g. for the outline
+    std::vector<vec3> smooth_normals;
+
+    // attributes of the vertices in the frame being rendered, written from
+    // the object-space ones by VertexKernel: the world-space position and
+    // normal, and the screen-space position and w
+    std::vector<vec3> world_positions;
+    std::vector<vec3> world_normals;
+    std::vector<vec3> screen_positions;
+    std::vector<float> ws;
+
+    // the vertices of the triangle t are indices[3 * t, 3 * t + 3)
+    std::vector<uint32_t> indices;
+    // material of each triangle in `materials`, or NO_MATERIAL
+    std::vector<uint32_t> material_ids;
+
+    std::vector<std::shared_ptr<Material>> materials;
+
+    size_t vertices_size() const;
+    size_t triangles_size() const;
+
+    // Append a vertex and return its index.
+    uint32_t add_vertex(const vec3 &position, const vec3 &normal,
+                        const vec2 &texcoord, const vec3 &smooth_normal);
+
+    // Append a triangle of the vertices and return its index.
+    uint32_t add_triangle(const uint32_t v0, const uint32_t v1,
+                          const uint32_t v2, const uint32_t material_id);
+
+    // Reorder the triangles so that the triangle t is the triangle order[t]
+    // before, and renumber the vertices in the order of their first use by
+    // the triangles, followed by the vertices not used.
+    void reorder(const std::vector<uint32_t> &order);
+
+    // Return the material of the triangle, or nullptr.
+    inline Material *material(const size_t triangle) const;
+};
+
+inline Material *Mesh::material(const size_t triangle) const {
+    uint32_t id = material_ids[triangle];
+    return id == NO_MATERIAL ? nullptr : materials[id].get();
+}
+
+#endif
@@ -8,9 +8,13 @@
 #include <unordered_map>
 #include <vector>
 
+#include "geometry/cluster.hpp"
+#include "geometry/mesh.hpp"
 #include "geometry/shape.hpp"
+#include "geometry/triangle.hpp"
 #include "global.hpp"
 #include "scene/material.hpp"
+#include "texture/alpha_hierarchy.hpp"
 #include "utils/transform.hpp"
 
 class Object {
@@ -20,9 +24,12 @@ class Object {
     PositionTransform model_transform;
     NormalTransform normal_transform;
 
-    std::vector<std::shared_ptr<Vertex>> vertices;
-    std::vector<std::shared_ptr<vec3>> normals;
-    std::vector<std::shared_ptr<vec2>> texcoords;
+    // vertices, indices and materials of all shapes, at a fixed address as
+    // the triangles refer to it
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+
+    // rasterization record of each triangle of the mesh, in the same order
+    std::vector<Triangle> triangles;
 
     //////////////////////////
     /// Texture maps BEGIN ///
@@ -38,19 +45,44 @@ class Object {
     std::unordered_map<std::string, std::shared_ptr<Mipmap<vec3>>> mipmap3_map;
     std::unordered_map<std::string, std::shared_ptr<Mipmap<float>>>
         mipmap_alpha_map;
+    std::unordered_map<std::string, std::shared_ptr<AlphaHierarchy>>
+        alpha_hierarchy_map;
 
     ////////////////////////
     /// Texture maps END ///
     ////////////////////////
 
-    std::vector<std::shared_ptr<Material>> materials;
-
     std::vector<Shape> shapes;
 
+    // clusters of the triangles of each shape, in the order of the triangles
+    std::vector<Cluster> clusters;
+
     Object();
     Object(const vec3 &pos, const vec3 &rotation, const vec3 &scale);
     bool load_model(const std::string &filename, const std::string &basepath);
-    void do_model_transform();
+
+    // Return the world-space position of the object-space position.
+    vec3 world_position(const vec3 &pos) const;
+
+    // Return the world-space direction of the object-space normal.
+    vec3 world_normal(const vec3 &normal) const;
+
+    // Split each shape into clusters of at most cluster::MAX_TRIANGLES
+    // consecutive triangles, after the triangles are loaded or reordered.
+    void build_clusters();
+
+    // Return the world-space bounds of the object-space bounds of a cluster.
+    ClusterBounds world_bounds(const ClusterBounds &bounds) const;
+
+    // Reorder the triangles of each shape along a Morton curve of their
+    // centroids, and the vertices in the order of their first use, so that
+    // consecutive triangles are near in the space and share vertices near in
+    // memory. The shapes keep their ranges of triangles.
+    void optimize_mesh();
+
+    // Classify the alpha coverage of all triangles, after their materials are
+    // assigned.
+    void classify_alpha();
 
     template <typename T>
     std::shared_ptr<Texture<T>> load_texture(
@@ -67,6 +99,9 @@ class Object {
 
     std::shared_ptr<Mipmap<float>> load_mipmap_alpha(
         const std::string &texname, const std::filesystem::path &base_path);
+
+    std::shared_ptr<AlphaHierarchy> load_alpha_hierarchy(
+        const std::string &texname, const std::filesystem::path &base_path);
 };
 
 template <typename T>
@@ -2,13 +2,13 @@
 #ifndef SHAPE_H
 #define SHAPE_H
 
-#include <vector>
-
-#include "geometry/triangle.hpp"
+#include <cstddef>
 
+// Triangles [first, first + size) of the mesh of the object.
 class Shape {
    public:
-    std::vector<Triangle> triangles;
+    size_t first = 0;
+    size_t size = 0;
 };
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <tuple>
@@ -11,35 +12,125 @@
 #include <vector>
 
 #include "effects/msaa.hpp"
-#include "geometry/vertex.hpp"
+#include "geometry/mesh.hpp"
 #include "global.hpp"
+#include "rasterizer/coverage_kernel.hpp"
+#include "rasterizer/hi_z_buffer.hpp"
+#include "rasterizer/setup_buffer.hpp"
+#include "rasterizer/tile.hpp"
 #include "scene/camera.hpp"
 #include "scene/material.hpp"
 #include "shader/fragment_shader.hpp"
+#include "texture/alpha_hierarchy.hpp"
 #include "texture/buffer.hpp"
-#include "utils/omp_locker.hpp"
 
+// Rasterization record of a triangle of a mesh, holding the per-triangle data
+// for the traversal and the shading, while its vertices stay in the mesh.
 class Triangle {
    public:
-    std::vector<std::shared_ptr<Vertex>> vertices;
-    std::vector<std::shared_ptr<vec3>> normals;
-    std::vector<std::shared_ptr<vec2>> texcoords;
-    std::shared_ptr<Material> material = nullptr;
+    const Mesh *mesh = nullptr;
+    // triangle index in the mesh
+    uint32_t id = 0;
+
+    // if all vertices have a normal, or a texcoord
+    bool has_normals = false;
+    bool has_texcoords = false;
 
     enum CullMethod { NO_CULL, CULL_BACK, CULL_FRONT };
 
+    // alpha test result of the whole triangle, see classify_alpha()
+    AlphaHierarchy::Coverage alpha_coverage = AlphaHierarchy::OPAQUE;
+
    private:
+    // shading state written by setup(), kept here rather than in the setup
+    // record for the deferred shading, see SetupBuffer
     vec3 tbn_u = vec3(0, 0, 0);
 
+    // derivatives of the screen-space barycentric coordinate
+    vec3 barycoord_dx = vec3(0, 0, 0);
+    vec3 barycoord_dy = vec3(0, 0, 0);
+
+    // screen-space derivatives of the linearly interpolated 1 / w and uv / w,
+    // for the closed-form uv derivatives
+    float inv_w_dx = 0;
+    float inv_w_dy = 0;
+    vec2 uv_over_w_dx = vec2(0, 0);
+    vec2 uv_over_w_dy = vec2(0, 0);
+
    public:
-    vec3 normal() const;
+    Triangle(const Mesh *mesh, const uint32_t id, const bool has_normals,
+             const bool has_texcoords);
 
-    // Return if the point is inside the triangle in the screen space.
-    bool is_inside_ss(const vec3 &w_ss) const;
+    // Attributes of the vertex i of the triangle in the frame being rendered,
+    // see Mesh.
+    inline const vec3 &pos(const size_t i) const;
+    inline const vec3 &screen_pos(const size_t i) const;
+    inline float w(const size_t i) const;
+    inline const vec3 &vertex_normal(const size_t i) const;
+    inline const vec2 &texcoord(const size_t i) const;
 
-    template <typename FragmentShaderT>
-    void rasterize(Buffer *buffer, FragmentShaderT *fragment_shader,
-                   const Camera &camera, CullMethod = NO_CULL);
+    // Return the material of the triangle, or nullptr.
+    inline Material *material() const;
+
+    // Return the normal of the triangle plane.
+    vec3 normal() const;
+
+    // Classify the alpha test of the triangle by the bounds of its uv, with the
+    // alpha hierarchy of the material.
+    void classify_alpha();
+
+    // Return if the triangle is fully transparent, outside the view, has zero
+    // area in the screen space, or faces the culled side.
+    bool is_culled(const Camera &camera, CullMethod cull_method) const;
+
+    // Prepare the per-triangle data for shading of a triangle not culled, and
+    // append the setup record for the traversal into `setups`. Return false
+    // if the triangle covers no pixel, in which case nothing is appended.
+    bool setup(const Camera &camera, SetupBuffer *setups);
+
+    // Rasterize the part of the triangle inside the tile, with the setup
+    // record at `index` of `setups`. The tile must not be rasterized
+    // concurrently.
+    template <size_t MSAA_LEVEL, typename FragmentShaderT>
+    void rasterize(Buffer<MSAA_LEVEL> *buffer, FragmentShaderT *fragment_shader,
+                   const Camera &camera, const SetupBuffer &setups,
+                   const size_t index, const Tile &tile,
+                   CullMethod cull_method = NO_CULL,
+                   coverage::DepthTest depth_test = coverage::DEPTH_LESS);
+
+    // Rasterize the part of the triangle inside the tile into the z-buffer and
+    // the visibility buffer without shading.
+    template <size_t MSAA_LEVEL>
+    void rasterize_visibility(
+        Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+        const SetupBuffer &setups, const size_t index, const Tile &tile,
+        CullMethod cull_method = NO_CULL,
+        coverage::DepthTest depth_test = coverage::DEPTH_LESS);
+
+    // Rasterize the part of the triangle inside the tile into the z-buffer
+    // only, e.g. as a depth prepass.
+    template <size_t MSAA_LEVEL>
+    void rasterize_depth(Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+                         const SetupBuffer &setups, const size_t index,
+                         const Tile &tile, CullMethod cull_method = NO_CULL);
+
+    // Rasterize the triangle without the depth test and without writing the
+    // buffer, calling `write_sample(pixel_x, pixel_y, i, z)` for each sample i
+    // inside the triangle passing the cull test and the alpha test, where `z`
+    // is its depth. Thread-safe if `write_sample` is.
+    template <size_t MSAA_LEVEL, typename WriteSampleT>
+    void rasterize_samples(const Buffer<MSAA_LEVEL> *buffer,
+                           const Camera &camera, const SetupBuffer &setups,
+                           const size_t index, CullMethod cull_method,
+                           WriteSampleT &&write_sample) const;
+
+    // Shade the samples of the pixel flagged in `covered_flag`, which are
+    // visible in the visibility buffer.
+    template <size_t MSAA_LEVEL, typename FragmentShaderT>
+    void shade_visible(Buffer<MSAA_LEVEL> *buffer,
+                       FragmentShaderT *fragment_shader, const Camera &camera,
+                       const int pixel_x, const int pixel_y,
+                       const unsigned char covered_flag) const;
 
    private:
     // Calculate the cross product of two 2-dimension vectors.
@@ -48,14 +139,42 @@ class Triangle {
     // Truncate x-coordinate of pixels into screen spaces.
     static float truncate_x_ss(float x, const Camera &camera);
 
-    // Truncate y-coordinate of pixels into screen spaces.
+    // Truncate y-coordinate of pixels into the rows of the frame rendered by
+    // the camera, see Camera::band().
     static float truncate_y_ss(float y, const Camera &camera);
 
+    // Return 1 if the normal at `pos` faces the camera, -1 if it faces away,
+    // or 0 if the cosine between them is within EPS.
+    static int facing(const vec3 &normal, const vec3 &pos,
+                      const Camera &camera);
+
+    // Cull test by the vertex normals, only used for triangles with normals.
     bool is_culled_normal(const Camera &camera, CullMethod cull_method) const;
     bool is_culled_normal(const vec3 &normal, const vec3 &pos,
                           const Camera &camera, CullMethod cull_method) const;
     bool is_culled_view(const Camera &camera) const;
 
+    // Return the pixel range [min_x, max_x) x [min_y, max_y) covered by the
+    // triangle in the rendered image, whose row y is the row
+    // y + camera.offset_y of the frame.
+    std::tuple<int, int, int, int> bounding_box_ss(const Camera &camera) const;
+
+    // Calculate the fixed-point edge functions of the three edges at the
+    // top-left corner of the pixel (min_x, min_y) of the frame, and their
+    // steps per pixel.
+    // Return false if the triangle is degenerate.
+    bool calc_edges(const int min_x, const int min_y, int64_t *edge,
+                    int64_t *edge_dx, int64_t *edge_dy) const;
+
+    // Classify the alpha test of the samples inside the screen-space rectangle
+    // [min_x, max_x] x [min_y, max_y], with the screen-space barycentric
+    // coordinate `barycoord` at the pixel center (x, y).
+    AlphaHierarchy::Coverage classify_alpha_ss(const int x, const int y,
+                                               const vec3 &barycoord,
+                                               const int min_x, const int min_y,
+                                               const int max_x,
+                                               const int max_y) const;
+
     // Calculate the screen-space barycentric coordinate at the pixel position.
     vec3 barycoord_ss(const vec2 &screen_pos) const;
 
@@ -64,7 +183,7 @@ class Triangle {
 
     // Convert screen space barycentic coordinate to perspective-corrected (view
     // space) barycentic coordinate.
-    std::tuple<float, float, float> corrected_barycoord(
+    inline std::tuple<float, float, float> corrected_barycoord(
         const vec3 &barycoord_ss) const;
 
     // Interpolate any value with a barycentic coordinate.
@@ -72,18 +191,122 @@ class Triangle {
     static T interpolate(const std::tuple<T, T, T> &vals,
                          const std::tuple<float, float, float> &weights);
 
+    // Calculate the screen-space barycentric coordinate of the MSAA samples,
+    // relative to the pixel center.
+    template <size_t MSAA_LEVEL>
+    void calc_barycoord_samples_delta(const Buffer<MSAA_LEVEL> *buffer,
+                                      vec3 *barycoord_samples_delta) const;
+
+    // Walk the pixels of the triangle inside the tile, do the inside test, cull
+    // test, alpha test and depth test, and write the z-buffer. The alpha test
+    // only runs on the blocks classified as mixed. Then call
+    // `write_pixel(pixel_x, pixel_y, covered_flag, barycoord)` for each pixel
+    // with covered samples, where `barycoord` is the screen-space barycentric
+    // coordinate at the pixel center.
+    template <coverage::DepthTest DEPTH_TEST, size_t MSAA_LEVEL,
+              typename WritePixelT>
+    void traverse(Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+                  const SetupBuffer &setups, const size_t index,
+                  const Tile &tile, CullMethod cull_method,
+                  WritePixelT &&write_pixel) const;
+
+    // Write the depth of the samples flagged in `covered_flag` into the
+    // z-buffer.
+    template <size_t MSAA_LEVEL>
+    static inline void write_z_buffer(Buffer<MSAA_LEVEL> *buffer,
+                                      const int pixel_x, const int pixel_y,
+                                      const unsigned char covered_flag,
+                                      const float *z);
+
+    // After a depth prepass, claim the samples flagged in `covered_flag` which
+    // are not written by any previous fragment at equal depth, and return
+    // their flags.
+    template <size_t MSAA_LEVEL>
+    static inline unsigned char claim_samples(Buffer<MSAA_LEVEL> *buffer,
+                                              const int pixel_x,
+                                              const int pixel_y,
+                                              const unsigned char covered_flag);
+
+    // Return if the depth range starting at `min_z` is entirely behind the
+    // hierarchical z `max_z`.
+    template <coverage::DepthTest DEPTH_TEST>
+    static bool is_hi_z_rejected(const float min_z, const float max_z);
+
+    // Dispatch traverse() by the depth test.
+    template <size_t MSAA_LEVEL, typename WritePixelT>
+    void traverse(Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+                  const SetupBuffer &setups, const size_t index,
+                  const Tile &tile, CullMethod cull_method,
+                  coverage::DepthTest depth_test,
+                  WritePixelT &&write_pixel) const;
+
+    // Apply the per-sample cull test and alpha test (if `alpha_test`) to the
+    // samples flagged in `covered_flag`, and return the flags of the samples
+    // passing both.
+    unsigned char test_samples(const unsigned char covered_flag,
+                               const vec3 &barycoord,
+                               const vec3 *barycoord_samples_delta,
+                               const Camera &camera, CullMethod cull_method,
+                               const bool alpha_test) const;
+
+    // Shade the pixel once for all covered samples, and write the results into
+    // the buffer.
+    template <size_t MSAA_LEVEL, typename FragmentShaderT>
+    void shade_pixel(Buffer<MSAA_LEVEL> *buffer,
+                     FragmentShaderT *fragment_shader, const int pixel_x,
+                     const int pixel_y, const unsigned char covered_flag,
+                     const vec3 &barycoord,
+                     const vec3 *barycoord_samples_delta) const;
+
     template <typename FragmentShaderT>
     std::tuple<vec3, vec3, vec3> shade(size_t pixel_x, size_t pixel_y,
                                        const std::tuple<float, float, float> &w,
                                        const vec2 &uv, const vec2 &duv,
                                        FragmentShaderT *fragment_shader) const;
 
+    // Calculate the uv and the uv derivatives for mipmap sampling at the
+    // shading point.
     std::tuple<vec2, vec2> calc_uv(
         const std::tuple<float, float, float> &w_shading,
-        const vec3 &barycoord_shading,
-        const std::tuple<vec3, vec3> &barycoord_lod_sample_delta) const;
+        const vec3 &barycoord_shading) const;
 };
 
+inline const vec3 &Triangle::pos(const size_t i) const {
+    return mesh->world_positions[mesh->indices[3 * id + i]];
+}
+
+inline const vec3 &Triangle::screen_pos(const size_t i) const {
+    return mesh->screen_positions[mesh->indices[3 * id + i]];
+}
+
+inline float Triangle::w(const size_t i) const {
+    return mesh->ws[mesh->indices[3 * id + i]];
+}
+
+inline const vec3 &Triangle::vertex_normal(const size_t i) const {
+    return mesh->world_normals[mesh->indices[3 * id + i]];
+}
+
+inline const vec2 &Triangle::texcoord(const size_t i) const {
+    return mesh->texcoords[mesh->indices[3 * id + i]];
+}
+
+inline Material *Triangle::material() const { return mesh->material(id); }
+
+inline std::tuple<float, float, float> Triangle::corrected_barycoord(
+    const vec3 &barycoord_ss) const {
+    float w1 = w(0);
+    float w2 = w(1);
+    float w3 = w(2);
+
+    float alpha = barycoord_ss.x();
+    float beta = barycoord_ss.y();
+    float gamma = barycoord_ss.z();
+    float l = alpha / w1 + beta / w2 + gamma / w3;
+
+    return std::make_tuple(alpha / w1 / l, beta / w2 / l, gamma / w3 / l);
+}
+
 template <typename T>
 T Triangle::interpolate(const std::tuple<T, T, T> &vals,
                         const std::tuple<float, float, float> &weights) {
@@ -92,178 +315,596 @@ T Triangle::interpolate(const std::tuple<T, T, T> &vals,
     return w1 * v1 + w2 * v2 + w3 * v3;
 }
 
-template <typename FragmentShaderT>
-void Triangle::rasterize(Buffer *buffer, FragmentShaderT *fragment_shader,
-                         const Camera &camera, CullMethod cull_method) {
+template <size_t MSAA_LEVEL, typename FragmentShaderT>
+void Triangle::rasterize(Buffer<MSAA_LEVEL> *buffer,
+                         FragmentShaderT *fragment_shader, const Camera &camera,
+                         const SetupBuffer &setups, const size_t index,
+                         const Tile &tile, CullMethod cull_method,
+                         coverage::DepthTest depth_test) {
     static_assert(std::is_base_of_v<FragmentShader, FragmentShaderT>);
 
-    if (is_culled_normal(camera, cull_method)) return;
-    if (is_culled_view(camera)) return;
-
-    auto v1 = vertices[0];
-    auto v2 = vertices[1];
-    auto v3 = vertices[2];
-
-    // screen coordinate range
-    int min_x = truncate_x_ss(
-        std::floor(std::min(
-            {v1->screen_pos.x(), v2->screen_pos.x(), v3->screen_pos.x()})),
-        camera);
-    int min_y = truncate_y_ss(
-        std::floor(std::min(
-            {v1->screen_pos.y(), v2->screen_pos.y(), v3->screen_pos.y()})),
-        camera);
-    int max_x = truncate_x_ss(
-        std::ceil(std::max(
-            {v1->screen_pos.x(), v2->screen_pos.x(), v3->screen_pos.x()})),
-        camera);
-    int max_y = truncate_y_ss(
-        std::ceil(std::max(
-            {v1->screen_pos.y(), v2->screen_pos.y(), v3->screen_pos.y()})),
-        camera);
-
-    // barycentric coordinate
-    vec3 barycoord_init = barycoord_ss(vec2(min_x + 0.5f, min_y + 0.5f));
-    vec3 barycoord_dx =
-        barycoord_ss(vec2(min_x + 1.5f, min_y + 0.5f)) - barycoord_init;
-    vec3 barycoord_dy =
-        barycoord_ss(vec2(min_x + 0.5f, min_y + 1.5f)) - barycoord_init;
-
-    vec3 barycoord_samples_delta[msaa::MSAA_LEVEL];
-    for (size_t i = 0; i < msaa::MSAA_LEVEL; i++) {
-        barycoord_samples_delta[i] =
-            barycoord_ss(vec2(min_x, min_y) + msaa::samples_coord_delta[i]) -
-            barycoord_init;
-    }
+    vec3 barycoord_samples_delta[MSAA_LEVEL];
+    calc_barycoord_samples_delta(buffer, barycoord_samples_delta);
+
+    traverse(buffer, camera, setups, index, tile, cull_method, depth_test,
+             [&](const int pixel_x, const int pixel_y,
+                 const unsigned char covered_flag, const vec3 &barycoord) {
+                 shade_pixel(buffer, fragment_shader, pixel_x, pixel_y,
+                             covered_flag, barycoord, barycoord_samples_delta);
+             });
+}
+
+template <size_t MSAA_LEVEL>
+void Triangle::rasterize_visibility(Buffer<MSAA_LEVEL> *buffer,
+                                    const Camera &camera,
+                                    const SetupBuffer &setups,
+                                    const size_t index, const Tile &tile,
+                                    CullMethod cull_method,
+                                    coverage::DepthTest depth_test) {
+    traverse(buffer, camera, setups, index, tile, cull_method, depth_test,
+             [&](const int pixel_x, const int pixel_y,
+                 const unsigned char covered_flag, const vec3 &barycoord) {
+                 for (size_t i = 0; i < MSAA_LEVEL; i++) {
+                     if (covered_flag & (1u << i)) {
+                         buffer->visibility_buffer->at(pixel_x, pixel_y)[i] =
+                             this;
+                     }
+                 }
+             });
+}
+
+template <size_t MSAA_LEVEL>
+void Triangle::rasterize_depth(Buffer<MSAA_LEVEL> *buffer,
+                               const Camera &camera, const SetupBuffer &setups,
+                               const size_t index, const Tile &tile,
+                               CullMethod cull_method) {
+    traverse<coverage::DEPTH_LESS>(
+        buffer, camera, setups, index, tile, cull_method,
+        [](const int pixel_x, const int pixel_y,
+           const unsigned char covered_flag, const vec3 &barycoord) {});
+}
 
-    // mipmap lod related barycentric coordinate
-    vec3 barycoord_lod_sample_x_delta =
-        barycoord_ss(
-            vec2(min_x + 0.5f + mipmap::LOD_SAMPLE_DELTA, min_y + 0.5f)) -
-        barycoord_init;
-    vec3 barycoord_lod_sample_y_delta =
-        barycoord_ss(
-            vec2(min_x + 0.5f, min_y + 0.5f + mipmap::LOD_SAMPLE_DELTA)) -
-        barycoord_init;
-    auto barycoord_lod_sample_delta = std::make_tuple(
-        barycoord_lod_sample_x_delta, barycoord_lod_sample_y_delta);
-
-    // tangent space conversion
-    if (!texcoords.empty() && material->normal_texture != nullptr) {
-        vec3 e1 = vertices[0]->pos - vertices[1]->pos;
-        vec3 e2 = vertices[0]->pos - vertices[2]->pos;
-
-        vec2 delta_uv1 = *texcoords[0] - *texcoords[1];
-        vec2 delta_uv2 = *texcoords[0] - *texcoords[2];
-
-        float f =
-            (delta_uv1.x() * delta_uv2.y() - delta_uv2.x() * delta_uv1.y());
-
-        tbn_u = ((delta_uv2.y() * e1 - delta_uv1.y() * e2) / f).normalized();
+template <size_t MSAA_LEVEL, typename WriteSampleT>
+void Triangle::rasterize_samples(const Buffer<MSAA_LEVEL> *buffer,
+                                 const Camera &camera,
+                                 const SetupBuffer &setups, const size_t index,
+                                 CullMethod cull_method,
+                                 WriteSampleT &&write_sample) const {
+    constexpr size_t BATCH_PIXELS = coverage::BATCH_PIXELS<MSAA_LEVEL>;
+
+    // depth of the far plane, so that the kernel only tests the depth range
+    static const auto far_z = msaa::texture_init_val<coverage::LANES>(1.f);
+
+    int min_x = setups.min_x[index];
+    int min_y = setups.min_y[index];
+    int max_x = setups.max_x[index];
+    int max_y = setups.max_y[index];
+
+    int64_t edge_dx[3], edge_dy[3];
+    for (size_t j = 0; j < 3; j++) {
+        edge_dx[j] = setups.edge_dx[j][index];
+        edge_dy[j] = setups.edge_dy[j][index];
     }
+    vec3 w_dx = setups.barycoord_dx(index);
+    vec3 w_dy = setups.barycoord_dy(index);
+    float z_dx = setups.z_dx[index];
+    float z_dy = setups.z_dy[index];
+
+    vec3 barycoord_samples_delta[MSAA_LEVEL];
+    calc_barycoord_samples_delta(buffer, barycoord_samples_delta);
+
+    const bool alpha_test = alpha_coverage == AlphaHierarchy::MIXED;
+
+    auto coverage_kernel = CoverageKernel<MSAA_LEVEL>(
+        buffer->lane_offsets, edge_dx, edge_dy, z_dx, z_dy);
 
-    vec3 barycoord_y = barycoord_init;
     for (int pixel_y = min_y; pixel_y < max_y; pixel_y++) {
-        vec3 barycoord_x = barycoord_y;
-        for (int pixel_x = min_x; pixel_x < max_x; pixel_x++) {
-            OmpLocker omp_locker(&buffer->mutex->at(pixel_x, pixel_y));
-            vec3 barycoord_samples[msaa::MSAA_LEVEL];
-            unsigned char covered_flag = 0;
-            // for each MSAA sample
-            for (size_t i = 0; i < msaa::MSAA_LEVEL; i++) {
-                // screen-space barycentric coordinate
-                barycoord_samples[i] = barycoord_x + barycoord_samples_delta[i];
-
-                // inside test
-                if (!is_inside_ss(barycoord_samples[i])) continue;
-
-                auto w_sample = corrected_barycoord(barycoord_samples[i]);
-
-                // cull test
-                if (!normals.empty()) {  // if normals.empty() == true, culling
-                                         // is finished at the beginning.
-                    vec3 normal = interpolate(
-                        std::make_tuple(*normals[0], *normals[1], *normals[2]),
-                        w_sample);
-                    vec3 pos = interpolate(
-                        std::make_tuple(v1->pos, v2->pos, v3->pos), w_sample);
-                    if (is_culled_normal(normal, pos, camera, cull_method))
-                        continue;
+        for (int batch_x = min_x; batch_x < max_x; batch_x += BATCH_PIXELS) {
+            int offset_x = batch_x - min_x;
+            int offset_y = pixel_y - min_y;
+            int plane_offset_y = pixel_y - setups.plane_y[index];
+
+            int64_t edge_batch[3];
+            for (size_t j = 0; j < 3; j++) {
+                edge_batch[j] = setups.edge[j][index] + edge_dx[j] * offset_x +
+                                edge_dy[j] * offset_y;
+            }
+            float z_batch =
+                setups.z[index] + z_dx * offset_x + z_dy * plane_offset_y;
+
+            size_t batch_pixels =
+                std::min<size_t>(BATCH_PIXELS, max_x - batch_x);
+            float z_samples[coverage::LANES];
+            uint32_t batch_flag =
+                coverage_kernel.template evaluate<coverage::DEPTH_LESS>(
+                    edge_batch, z_batch, far_z.data(), batch_pixels,
+                    z_samples);
+            if (!batch_flag) continue;
+
+            vec3 barycoord = setups.barycoord(index) + w_dx * offset_x +
+                             w_dy * plane_offset_y;
+            for (size_t p = 0; p < batch_pixels; p++, barycoord += w_dx) {
+                unsigned char covered_flag =
+                    (batch_flag >> (p * MSAA_LEVEL)) & ((1u << MSAA_LEVEL) - 1);
+                if (!covered_flag) continue;
+
+                covered_flag = test_samples(covered_flag, barycoord,
+                                            barycoord_samples_delta, camera,
+                                            cull_method, alpha_test);
+                for (size_t i = 0; i < MSAA_LEVEL; i++) {
+                    if (covered_flag & (1u << i)) {
+                        write_sample(batch_x + p, pixel_y, i,
+                                     z_samples[p * MSAA_LEVEL + i]);
+                    }
                 }
+            }
+        }
+    }
+}
 
-                // alpha test
-                if (material->alpha_texture != nullptr) {
-                    vec2 uv = interpolate(
-                        std::make_tuple(*texcoords[0], *texcoords[1],
-                                        *texcoords[2]),
-                        w_sample);
-                    if (material->alpha_texture->sample(uv) < EPS) continue;
-                }
+template <size_t MSAA_LEVEL>
+void Triangle::calc_barycoord_samples_delta(
+    const Buffer<MSAA_LEVEL> *buffer, vec3 *barycoord_samples_delta) const {
+    for (size_t i = 0; i < MSAA_LEVEL; i++) {
+        barycoord_samples_delta[i] =
+            barycoord_dx * (buffer->samples_coord_delta[i].x() - 0.5f) +
+            barycoord_dy * (buffer->samples_coord_delta[i].y() - 0.5f);
+    }
+}
 
-                // depth test
-                float z = interpolate_z_ss(barycoord_samples[i]);
-                if (0.0 < z && z < buffer->z_buffer->at(pixel_x, pixel_y)[i]) {
-                    // write into z-buffer
-                    buffer->z_buffer->at(pixel_x, pixel_y)[i] = z;
-                    covered_flag |= 1u << i;
+template <size_t MSAA_LEVEL>
+inline void Triangle::write_z_buffer(Buffer<MSAA_LEVEL> *buffer,
+                                     const int pixel_x, const int pixel_y,
+                                     const unsigned char covered_flag,
+                                     const float *z) {
+    auto &z_buffer_samples = buffer->z_buffer->at(pixel_x, pixel_y);
+    for (size_t i = 0; i < MSAA_LEVEL; i++) {
+        if (covered_flag & (1u << i)) z_buffer_samples[i] = z[i];
+    }
+}
+
+template <size_t MSAA_LEVEL>
+inline unsigned char Triangle::claim_samples(
+    Buffer<MSAA_LEVEL> *buffer, const int pixel_x, const int pixel_y,
+    const unsigned char covered_flag) {
+    auto &written_flag = buffer->prepass_written_flag->at(pixel_x, pixel_y);
+    unsigned char claimed_flag = covered_flag & ~written_flag;
+    written_flag |= claimed_flag;
+    return claimed_flag;
+}
+
+template <coverage::DepthTest DEPTH_TEST>
+bool Triangle::is_hi_z_rejected(const float min_z, const float max_z) {
+    if constexpr (DEPTH_TEST == coverage::DEPTH_LESS) {
+        return min_z >= max_z;
+    } else {
+        return min_z > max_z;
+    }
+}
+
+template <size_t MSAA_LEVEL, typename FragmentShaderT>
+void Triangle::shade_visible(Buffer<MSAA_LEVEL> *buffer,
+                             FragmentShaderT *fragment_shader,
+                             const Camera &camera, const int pixel_x,
+                             const int pixel_y,
+                             const unsigned char covered_flag) const {
+    static_assert(std::is_base_of_v<FragmentShader, FragmentShaderT>);
+
+    vec3 barycoord_samples_delta[MSAA_LEVEL];
+    calc_barycoord_samples_delta(buffer, barycoord_samples_delta);
+
+    vec3 barycoord = barycoord_ss(
+        vec2(pixel_x + 0.5f, pixel_y + camera.offset_y + 0.5f));
+
+    shade_pixel(buffer, fragment_shader, pixel_x, pixel_y, covered_flag,
+                barycoord, barycoord_samples_delta);
+}
+
+template <size_t MSAA_LEVEL, typename WritePixelT>
+void Triangle::traverse(Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+                        const SetupBuffer &setups, const size_t index,
+                        const Tile &tile, CullMethod cull_method,
+                        coverage::DepthTest depth_test,
+                        WritePixelT &&write_pixel) const {
+    switch (depth_test) {
+        case coverage::DEPTH_LESS:
+            traverse<coverage::DEPTH_LESS>(buffer, camera, setups, index, tile,
+                                           cull_method, write_pixel);
+            break;
+        case coverage::DEPTH_EQUAL:
+            traverse<coverage::DEPTH_EQUAL>(buffer, camera, setups, index,
+                                            tile, cull_method, write_pixel);
+            break;
+    }
+}
+
+template <coverage::DepthTest DEPTH_TEST, size_t MSAA_LEVEL,
+          typename WritePixelT>
+void Triangle::traverse(Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+                        const SetupBuffer &setups, const size_t index,
+                        const Tile &tile, CullMethod cull_method,
+                        WritePixelT &&write_pixel) const {
+    constexpr size_t BATCH_PIXELS = coverage::BATCH_PIXELS<MSAA_LEVEL>;
+
+    // screen coordinate range, clipped by the tile
+    int min_x = std::max(setups.min_x[index], tile.min_x);
+    int min_y = std::max(setups.min_y[index], tile.min_y);
+    int max_x = std::min(setups.max_x[index], tile.max_x);
+    int max_y = std::min(setups.max_y[index], tile.max_y);
+    if (min_x >= max_x || min_y >= max_y) return;
+
+    // hierarchical z: reject the triangle if it is behind all blocks
+    float min_z = setups.min_z[index];
+    auto hi_z_buffer = buffer->hi_z_buffer.get();
+    if (is_hi_z_rejected<DEPTH_TEST>(
+            min_z, hi_z_buffer->max_z(min_x, min_y, max_x, max_y)))
+        return;
+
+    // edge functions at the top-left corner of the pixel (min_x, min_y), and
+    // their steps
+    int offset_x = min_x - setups.min_x[index];
+    int offset_y = min_y - setups.min_y[index];
+    int plane_offset_y = min_y - setups.plane_y[index];
+    int64_t edge_dx[3], edge_dy[3], edge_init[3];
+    for (size_t j = 0; j < 3; j++) {
+        edge_dx[j] = setups.edge_dx[j][index];
+        edge_dy[j] = setups.edge_dy[j][index];
+        edge_init[j] = setups.edge[j][index] + edge_dx[j] * offset_x +
+                       edge_dy[j] * offset_y;
+    }
+
+    // screen-space barycentric coordinate and z-coordinate at the pixel
+    // center (min_x, min_y), and their derivatives
+    vec3 w_dx = setups.barycoord_dx(index);
+    vec3 w_dy = setups.barycoord_dy(index);
+    vec3 barycoord_init =
+        setups.barycoord(index) + w_dx * offset_x + w_dy * plane_offset_y;
+    float z_dx = setups.z_dx[index];
+    float z_dy = setups.z_dy[index];
+    float z_init = setups.z[index] + z_dx * offset_x + z_dy * plane_offset_y;
+
+    vec3 barycoord_samples_delta[MSAA_LEVEL];
+    calc_barycoord_samples_delta(buffer, barycoord_samples_delta);
+
+    // only the triangles of mixed alpha are tested per block and per sample
+    const bool alpha_test = alpha_coverage == AlphaHierarchy::MIXED;
+
+    // Test and write the covered samples of the batch starting at the pixel
+    // (batch_x, pixel_y), with the coverage mask `batch_flag`. Return if any
+    // sample is written.
+    auto write_batch = [&](const uint32_t batch_flag, const int batch_x,
+                           const int pixel_y, const size_t batch_pixels,
+                           const float *z_samples, const bool alpha_test) {
+        bool written = false;
+        vec3 barycoord_x = barycoord_init + w_dx * (batch_x - min_x) +
+                           w_dy * (pixel_y - min_y);
+        for (size_t p = 0; p < batch_pixels; p++, barycoord_x += w_dx) {
+            int pixel_x = batch_x + p;
+            unsigned char covered_flag =
+                (batch_flag >> (p * MSAA_LEVEL)) & ((1u << MSAA_LEVEL) - 1);
+
+            if (covered_flag) {
+                covered_flag =
+                    test_samples(covered_flag, barycoord_x,
+                                 barycoord_samples_delta, camera, cull_method,
+                                 alpha_test);
+            }
+
+            if constexpr (DEPTH_TEST == coverage::DEPTH_EQUAL) {
+                if (covered_flag) {
+                    covered_flag =
+                        claim_samples(buffer, pixel_x, pixel_y, covered_flag);
                 }
             }
 
             if (covered_flag) {
-                bool full_covered =
-                    (covered_flag == (1u << msaa::MSAA_LEVEL) - 1);
-
-                vec3 barycoord_shading;
-
-                if (full_covered) {  // All samples covered
-                    barycoord_shading = barycoord_x;
-                } else {  // Partical samples covered
-                    barycoord_shading = vec3(0, 0, 0);
-                    int covered_count = 0;
-                    for (size_t i = 0; i < msaa::MSAA_LEVEL; i++) {
-                        if ((covered_flag >> i) & 1) {
-                            barycoord_shading += barycoord_samples[i];
-                            covered_count++;
-                        }
+                if constexpr (DEPTH_TEST == coverage::DEPTH_LESS) {
+                    write_z_buffer(buffer, pixel_x, pixel_y, covered_flag,
+                                   z_samples + p * MSAA_LEVEL);
+                    written = true;
+                }
+
+                write_pixel(pixel_x, pixel_y, covered_flag, barycoord_x);
+            }
+        }
+        return written;
+    };
+
+    // small triangles: evaluate the few batches without a kernel, and skip
+    // the block-level hierarchical z. The batches are split and the depth is
+    // stepped per block as below, so that a triangle taking either path in
+    // neighbouring tiles gets the same depth.
+    if (max_x - min_x <= coverage::SMALL_TRIANGLE_SIZE &&
+        max_y - min_y <= coverage::SMALL_TRIANGLE_SIZE) {
+        for (int pixel_y = min_y; pixel_y < max_y; pixel_y++) {
+            for (int block_x = min_x - min_x % hi_z::BLOCK_SIZE;
+                 block_x < max_x; block_x += hi_z::BLOCK_SIZE) {
+                int block_min_x = std::max(block_x, min_x);
+                int block_max_x = std::min(block_x + hi_z::BLOCK_SIZE, max_x);
+                float z_x = z_init + z_dx * (block_min_x - min_x) +
+                            z_dy * (pixel_y - min_y);
+                hi_z_buffer->decompress(block_x, pixel_y);
+
+                bool block_written = false;
+                for (int batch_x = block_min_x; batch_x < block_max_x;
+                     batch_x += BATCH_PIXELS) {
+                    int64_t edge_batch[3];
+                    for (size_t j = 0; j < 3; j++) {
+                        edge_batch[j] = edge_init[j] +
+                                        edge_dx[j] * (batch_x - min_x) +
+                                        edge_dy[j] * (pixel_y - min_y);
                     }
-                    barycoord_shading /= covered_count;
+
+                    size_t batch_pixels =
+                        std::min<size_t>(BATCH_PIXELS, block_max_x - batch_x);
+                    float z_samples[coverage::LANES];
+                    uint32_t batch_flag = CoverageKernel<MSAA_LEVEL>::template
+                        evaluate_once<DEPTH_TEST>(
+                            buffer->lane_offsets, edge_batch, edge_dx,
+                            edge_dy, z_x, z_dx, z_dy,
+                            buffer->z_buffer->at(batch_x, pixel_y).data(),
+                            batch_pixels, z_samples);
+
+                    if (batch_flag &&
+                        write_batch(batch_flag, batch_x, pixel_y,
+                                    batch_pixels, z_samples, alpha_test)) {
+                        block_written = true;
+                    }
+
+                    z_x += z_dx * BATCH_PIXELS;
+                }
+
+                if (block_written) hi_z_buffer->mark_dirty(block_x, pixel_y);
+            }
+        }
+        return;
+    }
+
+    auto coverage_kernel = CoverageKernel<MSAA_LEVEL>(
+        buffer->lane_offsets, edge_dx, edge_dy, z_dx, z_dy);
+
+    // Write the block [block_x, block_max_x) x [block_y, block_max_y) inside
+    // the triangle as a compressed block, if the triangle is in front of all
+    // its samples and all samples pass the per-sample tests. Return false
+    // without writing anything otherwise.
+    auto compress_block = [&](const int block_x, const int block_y,
+                              const int block_max_x, const int block_max_y) {
+        constexpr int BLOCK_PIXELS = hi_z::BLOCK_SIZE * hi_z::BLOCK_SIZE;
+        const size_t hi_z_x = block_x / hi_z::BLOCK_SIZE;
+        const size_t hi_z_y = block_y / hi_z::BLOCK_SIZE;
+        static const auto far_z = msaa::texture_init_val<coverage::LANES>(1.f);
+
+        // the farthest point of the triangle plane inside the block
+        float plane_max_z =
+            z_init +
+            z_dx * ((z_dx > 0 ? block_max_x : block_x) - (min_x + 0.5f)) +
+            z_dy * ((z_dy > 0 ? block_max_y : block_y) - (min_y + 0.5f));
+        float old_min_z = hi_z_buffer->block_min_z(hi_z_x, hi_z_y);
+        if (plane_max_z >= old_min_z) return false;
+
+        // evaluate the samples as the per-sample path does
+        vec3 barycoords[BLOCK_PIXELS];
+        float new_min_z = 1.f;
+        float new_max_z = 0.f;
+        int p = 0;
+        for (int pixel_y = block_y; pixel_y < block_max_y; pixel_y++) {
+            float z_x = z_init + z_dx * (block_x - min_x) +
+                        z_dy * (pixel_y - min_y);
+            for (int batch_x = block_x; batch_x < block_max_x;
+                 batch_x += BATCH_PIXELS) {
+                size_t batch_pixels =
+                    std::min<size_t>(BATCH_PIXELS, block_max_x - batch_x);
+                size_t lanes = batch_pixels * MSAA_LEVEL;
+                float z_samples[coverage::LANES];
+                uint32_t batch_flag =
+                    coverage_kernel.template evaluate_inside<DEPTH_TEST>(
+                        z_x, far_z.data(), batch_pixels, z_samples);
+                if (batch_flag != (1u << lanes) - 1) return false;
+                for (size_t k = 0; k < lanes; k++) {
+                    new_min_z = std::min(new_min_z, z_samples[k]);
+                    new_max_z = std::max(new_max_z, z_samples[k]);
                 }
 
-                // perspective-corrected interpolate
-                auto w_shading = corrected_barycoord(barycoord_shading);
-                auto [uv, duv] = calc_uv(w_shading, barycoord_shading,
-                                         barycoord_lod_sample_delta);
-                auto [shading, pos, normal] = shade(pixel_x, pixel_y, w_shading,
-                                                    uv, duv, fragment_shader);
-
-                for (size_t i = 0; i < msaa::MSAA_LEVEL; i++) {
-                    if (full_covered || (covered_flag & (1u << i))) {
-                        buffer->frame_buffer->at(pixel_x, pixel_y)[i] = shading;
-                        buffer->pos_buffer->at(pixel_x, pixel_y)[i] = pos;
-                        buffer->normal_buffer->at(pixel_x, pixel_y)[i] = normal;
+                vec3 barycoord_x = barycoord_init + w_dx * (batch_x - min_x) +
+                                   w_dy * (pixel_y - min_y);
+                for (size_t q = 0; q < batch_pixels;
+                     q++, barycoord_x += w_dx) {
+                    unsigned char covered_flag = test_samples(
+                        (1u << MSAA_LEVEL) - 1, barycoord_x,
+                        barycoord_samples_delta, camera, cull_method, false);
+                    if (covered_flag != (1u << MSAA_LEVEL) - 1) return false;
+                    barycoords[p++] = barycoord_x;
+                }
+
+                z_x += z_dx * BATCH_PIXELS;
+            }
+        }
+        if (new_max_z >= old_min_z) return false;
+
+        p = 0;
+        for (int pixel_y = block_y; pixel_y < block_max_y; pixel_y++) {
+            for (int pixel_x = block_x; pixel_x < block_max_x; pixel_x++) {
+                write_pixel(pixel_x, pixel_y, (1u << MSAA_LEVEL) - 1,
+                            barycoords[p++]);
+            }
+        }
+        hi_z_buffer->compress(hi_z_x, hi_z_y,
+                              DepthPlane{z_init, z_dx, z_dy, min_x, min_y},
+                              new_min_z, new_max_z);
+        return true;
+    };
+
+    // for each hierarchical z block
+    for (int block_y = min_y - min_y % hi_z::BLOCK_SIZE; block_y < max_y;
+         block_y += hi_z::BLOCK_SIZE) {
+        int block_min_y = std::max(block_y, min_y);
+        int block_max_y = std::min(block_y + hi_z::BLOCK_SIZE, max_y);
+
+        for (int block_x = min_x - min_x % hi_z::BLOCK_SIZE; block_x < max_x;
+             block_x += hi_z::BLOCK_SIZE) {
+            int block_min_x = std::max(block_x, min_x);
+            int block_max_x = std::min(block_x + hi_z::BLOCK_SIZE, max_x);
+
+            // classify the block by the edge functions at its corners, which
+            // bound the edge functions of all samples inside
+            bool block_outside = false;
+            bool block_inside = true;
+            int64_t edge_block[3];
+            for (size_t j = 0; j < 3; j++) {
+                edge_block[j] = edge_init[j] +
+                                edge_dx[j] * (block_min_x - min_x) +
+                                edge_dy[j] * (block_min_y - min_y);
+                int64_t extent_x = edge_dx[j] * (block_max_x - block_min_x);
+                int64_t extent_y = edge_dy[j] * (block_max_y - block_min_y);
+                int64_t edge_max = edge_block[j] +
+                                   std::max<int64_t>(extent_x, 0) +
+                                   std::max<int64_t>(extent_y, 0);
+                int64_t edge_min = edge_block[j] +
+                                   std::min<int64_t>(extent_x, 0) +
+                                   std::min<int64_t>(extent_y, 0);
+                if (edge_max <= 0) block_outside = true;
+                if (edge_min <= 0) block_inside = false;
+            }
+            if (block_outside) continue;
+
+            // reject the block if the nearest point of the triangle plane
+            // inside the block is behind it
+            float block_min_z = std::max(
+                min_z, z_init +
+                           z_dx * ((z_dx > 0 ? block_min_x : block_max_x) -
+                                   (min_x + 0.5f)) +
+                           z_dy * ((z_dy > 0 ? block_min_y : block_max_y) -
+                                   (min_y + 0.5f)));
+            if (is_hi_z_rejected<DEPTH_TEST>(
+                    block_min_z,
+                    hi_z_buffer->block_max_z(block_x / hi_z::BLOCK_SIZE,
+                                             block_y / hi_z::BLOCK_SIZE)))
+                continue;
+
+            // classify the alpha test of the block, skipping it if fully
+            // transparent
+            bool block_alpha_test = alpha_test;
+            if (alpha_test) {
+                auto block_coverage =
+                    classify_alpha_ss(min_x, min_y, barycoord_init, block_min_x,
+                                      block_min_y, block_max_x, block_max_y);
+                if (block_coverage == AlphaHierarchy::TRANSPARENT) continue;
+                block_alpha_test = block_coverage == AlphaHierarchy::MIXED;
+            }
+
+            // compress the block covered entirely by the triangle in front of
+            // all its samples, see HiZBuffer
+            if constexpr (DEPTH_TEST == coverage::DEPTH_LESS) {
+                if (block_inside && !block_alpha_test &&
+                    std::make_tuple(block_min_x, block_min_y, block_max_x,
+                                    block_max_y) ==
+                        hi_z_buffer->block_range(
+                            block_x / hi_z::BLOCK_SIZE,
+                            block_y / hi_z::BLOCK_SIZE) &&
+                    compress_block(block_x, block_y, block_max_x,
+                                   block_max_y)) {
+                    continue;
+                }
+            }
+            hi_z_buffer->decompress(block_x, block_y);
+
+            bool block_written = false;
+            for (int pixel_y = block_min_y; pixel_y < block_max_y; pixel_y++) {
+                float z_x = z_init + z_dx * (block_min_x - min_x) +
+                            z_dy * (pixel_y - min_y);
+                int64_t edge_x[3];
+                for (size_t j = 0; j < 3; j++) {
+                    edge_x[j] =
+                        edge_block[j] + edge_dy[j] * (pixel_y - block_min_y);
+                }
+                for (int batch_x = block_min_x; batch_x < block_max_x;
+                     batch_x += BATCH_PIXELS) {
+                    // inside test and depth test of the whole batch
+                    size_t batch_pixels =
+                        std::min<size_t>(BATCH_PIXELS, block_max_x - batch_x);
+                    float z_samples[coverage::LANES];
+                    const float *z_buffer =
+                        buffer->z_buffer->at(batch_x, pixel_y).data();
+                    uint32_t batch_flag =
+                        block_inside
+                            ? coverage_kernel
+                                  .template evaluate_inside<DEPTH_TEST>(
+                                      z_x, z_buffer, batch_pixels, z_samples)
+                            : coverage_kernel.template evaluate<DEPTH_TEST>(
+                                  edge_x, z_x, z_buffer, batch_pixels,
+                                  z_samples);
+
+                    if (batch_flag && write_batch(batch_flag, batch_x,
+                                                  pixel_y, batch_pixels,
+                                                  z_samples,
+                                                  block_alpha_test)) {
+                        block_written = true;
+                    }
+
+                    z_x += z_dx * BATCH_PIXELS;
+                    for (size_t j = 0; j < 3; j++) {
+                        edge_x[j] += edge_dx[j] * BATCH_PIXELS;
                     }
                 }
-                buffer->full_covered->at(pixel_x, pixel_y) = full_covered;
             }
-            barycoord_x += barycoord_dx;
+
+            if (block_written) hi_z_buffer->mark_dirty(block_x, block_y);
         }
-        barycoord_y += barycoord_dy;
     }
 }
 
+template <size_t MSAA_LEVEL, typename FragmentShaderT>
+void Triangle::shade_pixel(Buffer<MSAA_LEVEL> *buffer,
+                           FragmentShaderT *fragment_shader, const int pixel_x,
+                           const int pixel_y, const unsigned char covered_flag,
+                           const vec3 &barycoord,
+                           const vec3 *barycoord_samples_delta) const {
+    bool full_covered = (covered_flag == (1u << MSAA_LEVEL) - 1);
+
+    vec3 barycoord_shading;
+
+    if (full_covered) {  // All samples covered
+        barycoord_shading = barycoord;
+    } else {  // Partical samples covered
+        barycoord_shading = vec3(0, 0, 0);
+        int covered_count = 0;
+        for (size_t i = 0; i < MSAA_LEVEL; i++) {
+            if ((covered_flag >> i) & 1) {
+                barycoord_shading += barycoord + barycoord_samples_delta[i];
+                covered_count++;
+            }
+        }
+        barycoord_shading /= covered_count;
+    }
+
+    // perspective-corrected interpolate
+    auto w_shading = corrected_barycoord(barycoord_shading);
+    auto [uv, duv] = calc_uv(w_shading, barycoord_shading);
+    auto [shading, pos, normal] =
+        shade(pixel_x, pixel_y, w_shading, uv, duv, fragment_shader);
+
+    buffer->frame_buffer->write(pixel_x, pixel_y, covered_flag, shading);
+    buffer->pos_buffer->write(pixel_x, pixel_y, covered_flag, pos);
+    buffer->normal_buffer->write(pixel_x, pixel_y, covered_flag, normal);
+    buffer->full_covered->at(pixel_x, pixel_y) = full_covered;
+}
+
 template <typename FragmentShaderT>
 std::tuple<vec3, vec3, vec3> Triangle::shade(
     size_t pixel_x, size_t pixel_y, const std::tuple<float, float, float> &w,
     const vec2 &uv, const vec2 &duv, FragmentShaderT *fragment_shader) const {
-    vec3 pos = interpolate(
-        std::make_tuple(vertices[0]->pos, vertices[1]->pos, vertices[2]->pos),
-        w);
+    vec3 pos = interpolate(std::make_tuple(this->pos(0), this->pos(1),
+                                           this->pos(2)),
+                           w);
+
+    vec3 normal = !has_normals
+                      ? this->normal()
+                      : interpolate(std::make_tuple(vertex_normal(0),
+                                                    vertex_normal(1),
+                                                    vertex_normal(2)),
+                                    w);
 
-    vec3 normal =
-        normals.empty()
-            ? this->normal()
-            : interpolate(
-                  std::make_tuple(*normals[0], *normals[1], *normals[2]), w);
+    Material *material = this->material();
 
     // apply normal texture
     if (material->normal_texture != nullptr && !std::isnan(tbn_u.x())) {
@@ -290,7 +931,7 @@ std::tuple<vec3, vec3, vec3> Triangle::shade(
         normal = tbn.transpose() * uv_normal;
     }
 
-    vec3 shading = fragment_shader->shade(pos, normal, uv, duv, material.get());
+    vec3 shading = fragment_shader->shade(pos, normal, uv, duv, material);
 
     return std::make_tuple(shading, pos, normal);
 }
@@ -0,0 +1,138 @@
+#pragma once
+#ifndef ATOMIC_VISIBILITY_BUFFER_H
+#define ATOMIC_VISIBILITY_BUFFER_H
+
+#include <omp.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "geometry/triangle.hpp"
+#include "rasterizer/setup_buffer.hpp"
+#include "rasterizer/triangle_queue.hpp"
+#include "scene/camera.hpp"
+#include "texture/buffer.hpp"
+
+// Visibility of each MSAA sample packed into a 64-bit word, with the depth in
+// the high 32 bits and the submission order of the triangle in the low 32
+// bits, see TriangleQueue::for_each_visible().
+//
+// The triangles are rasterized in parallel without binning, and the depth
+// test and the visibility write of a sample are a single atomic
+// compare-and-swap keeping the minimum word, so no thread owns any pixel. The
+// depth of a sample passing the depth test is in (0, 1), where the bits of a
+// float are ordered as an unsigned integer, and fragments at equal depth are
+// resolved to the earliest submitted triangle, as in a single-threaded run.
+template <size_t MSAA_LEVEL>
+class AtomicVisibilityBuffer {
+   public:
+    size_t width;
+    size_t height;
+
+   private:
+    // word of the samples not written: the far plane, and no triangle
+    static const uint64_t EMPTY = (uint64_t(0x3f800000) << 32) | UINT32_MAX;
+
+    // default-initialized, as all words are stored once by the constructor
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+    // setup_buffers[thread_id]
+    std::vector<SetupBuffer> setup_buffers;
+
+   public:
+    AtomicVisibilityBuffer(const size_t width, const size_t height);
+
+    // Set up and rasterize the triangles not culled in the queue, in
+    // parallel.
+    void rasterize(const Buffer<MSAA_LEVEL> *buffer,
+                   TriangleQueue *triangle_queue, const Camera &camera,
+                   Triangle::CullMethod cull_method);
+
+    // Write the depth and the triangle of each written sample into the
+    // z-buffer and the visibility buffer.
+    void resolve(Buffer<MSAA_LEVEL> *buffer,
+                 const TriangleQueue &triangle_queue) const;
+
+   private:
+    // Keep the fragment at the sample i of the pixel if it is nearer than the
+    // current one. Thread-safe.
+    inline void write(const size_t x, const size_t y, const size_t i,
+                      const float z, const uint32_t order);
+};
+
+template <size_t MSAA_LEVEL>
+AtomicVisibilityBuffer<MSAA_LEVEL>::AtomicVisibilityBuffer(const size_t width,
+                                                           const size_t height)
+    : width(width),
+      height(height),
+      words(new std::atomic<uint64_t>[width * height * MSAA_LEVEL]),
+      setup_buffers(omp_get_max_threads()) {
+#pragma omp parallel for
+    for (size_t k = 0; k < width * height * MSAA_LEVEL; k++) {
+        words[k].store(EMPTY, std::memory_order_relaxed);
+    }
+}
+
+template <size_t MSAA_LEVEL>
+void AtomicVisibilityBuffer<MSAA_LEVEL>::rasterize(
+    const Buffer<MSAA_LEVEL> *buffer, TriangleQueue *triangle_queue,
+    const Camera &camera, Triangle::CullMethod cull_method) {
+    triangle_queue->for_each_visible([&](Triangle *triangle,
+                                         const uint32_t order) {
+        // the record is rasterized at once, so only one is kept per thread
+        auto &thread_setups = setup_buffers[omp_get_thread_num()];
+        thread_setups.clear();
+        if (!triangle->setup(camera, &thread_setups)) return;
+
+        triangle->rasterize_samples(
+            buffer, camera, thread_setups, 0, cull_method,
+            [&](const int pixel_x, const int pixel_y, const size_t i,
+                const float z) { write(pixel_x, pixel_y, i, z, order); });
+    });
+}
+
+template <size_t MSAA_LEVEL>
+void AtomicVisibilityBuffer<MSAA_LEVEL>::resolve(
+    Buffer<MSAA_LEVEL> *buffer, const TriangleQueue &triangle_queue) const {
+    // the blocks of the hierarchical z-buffer are still dirty since its
+    // creation, so they are refreshed from the z-buffer when queried
+#pragma omp parallel for
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            auto &z_samples = buffer->z_buffer->at(x, y);
+            auto &triangles = buffer->visibility_buffer->at(x, y);
+            for (size_t i = 0; i < MSAA_LEVEL; i++) {
+                uint64_t word = words[(y * width + x) * MSAA_LEVEL + i].load(
+                    std::memory_order_relaxed);
+                if (word == EMPTY) continue;
+
+                uint32_t z_bits = word >> 32;
+                std::memcpy(&z_samples[i], &z_bits, sizeof(float));
+                triangles[i] = triangle_queue.visible_at(uint32_t(word));
+            }
+        }
+    }
+}
+
+template <size_t MSAA_LEVEL>
+inline void AtomicVisibilityBuffer<MSAA_LEVEL>::write(const size_t x,
+                                                      const size_t y,
+                                                      const size_t i,
+                                                      const float z,
+                                                      const uint32_t order) {
+    uint32_t z_bits;
+    std::memcpy(&z_bits, &z, sizeof(float));
+    uint64_t word = (uint64_t(z_bits) << 32) | order;
+
+    auto &sample = words[(y * width + x) * MSAA_LEVEL + i];
+    uint64_t old_word = sample.load(std::memory_order_relaxed);
+    while (word < old_word &&
+           !sample.compare_exchange_weak(old_word, word,
+                                         std::memory_order_relaxed)) {
+    }
+}
+
+#endif
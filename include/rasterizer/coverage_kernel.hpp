@@ -0,0 +1,330 @@
+#pragma once
+#ifndef COVERAGE_KERNEL_H
+#define COVERAGE_KERNEL_H
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "effects/msaa.hpp"
+#include "global.hpp"
+
+namespace coverage {
+// Number of samples evaluated at once, one sample per SIMD lane.
+const size_t LANES = 8;
+static_assert(LANES % msaa::MAX_MSAA_LEVEL == 0);
+
+// Number of consecutive pixels evaluated at once.
+template <size_t MSAA_LEVEL>
+constexpr size_t BATCH_PIXELS = LANES / MSAA_LEVEL;
+
+// Number of sub-pixel bits of the fixed-point screen coordinates.
+const int SUBPIXEL_BITS = 8;
+const int64_t SUBPIXEL_SCALE = int64_t(1) << SUBPIXEL_BITS;
+
+// Maximum absolute screen coordinate in pixels, beyond which the fixed-point
+// edge functions may overflow.
+const float GUARD_BAND = 1 << 21;
+
+// Triangles covering at most SMALL_TRIANGLE_SIZE x SMALL_TRIANGLE_SIZE pixels
+// of a tile are evaluated without a kernel.
+const int SMALL_TRIANGLE_SIZE = 2;
+
+enum DepthTest {
+    // Pass if the depth is less than the z-buffer.
+    DEPTH_LESS,
+    // The z-buffer already holds the final depth from a depth prepass. Pass if
+    // the depth is not greater than the z-buffer.
+    DEPTH_EQUAL
+};
+
+// Offsets of the samples in the lanes from the first pixel of the batch.
+template <size_t MSAA_LEVEL>
+class LaneOffsets {
+   public:
+    // fixed-point offsets from the top-left corner
+    alignas(32) int64_t x[LANES];
+    alignas(32) int64_t y[LANES];
+
+    // offsets from the center
+    alignas(32) float dx[LANES];
+    alignas(32) float dy[LANES];
+
+    LaneOffsets(const vec2 *samples_coord_delta);
+};
+
+template <size_t MSAA_LEVEL>
+LaneOffsets<MSAA_LEVEL>::LaneOffsets(const vec2 *samples_coord_delta) {
+    for (size_t p = 0; p < BATCH_PIXELS<MSAA_LEVEL>; p++) {
+        for (size_t i = 0; i < MSAA_LEVEL; i++) {
+            size_t k = p * MSAA_LEVEL + i;
+            const vec2 &sample = samples_coord_delta[i];
+
+            x[k] = p * SUBPIXEL_SCALE +
+                   std::llround(sample.x() * SUBPIXEL_SCALE);
+            y[k] = std::llround(sample.y() * SUBPIXEL_SCALE);
+
+            dx[k] = p + sample.x() - 0.5f;
+            dy[k] = sample.y() - 0.5f;
+        }
+    }
+}
+}  // namespace coverage
+
+// Evaluate the inside test and the depth test of all MSAA samples of
+// coverage::BATCH_PIXELS<MSAA_LEVEL> consecutive pixels at once.
+//
+// Lane (p * MSAA_LEVEL + i) holds the sample i of the p-th pixel in the batch.
+template <size_t MSAA_LEVEL>
+class CoverageKernel {
+   private:
+    // fixed-point edge functions of the lanes, relative to the top-left
+    // corner of the first pixel of the batch
+    alignas(32) int64_t lane_edge[3][coverage::LANES];
+
+    // screen-space z-coordinate of the lanes, relative to the center of the
+    // first pixel of the batch
+    alignas(32) float lane_z[coverage::LANES];
+
+   public:
+    // `edge_dx` and `edge_dy` are the steps of the edge functions per pixel.
+    CoverageKernel(const coverage::LaneOffsets<MSAA_LEVEL> &offsets,
+                   const int64_t *edge_dx, const int64_t *edge_dy,
+                   const float z_dx, const float z_dy);
+
+    // Return the coverage mask of the batch starting at the pixel with the
+    // edge functions `edge` at its top-left corner and the z-coordinate
+    // `z_pixel` at its center. Bit k is set if the sample in lane k is inside
+    // the triangle and passes the depth test against `z_buffer`, which points
+    // to the MSAA samples of the first pixel. Only the first `pixels` pixels
+    // are evaluated. The depth of all lanes is written into `z`.
+    template <coverage::DepthTest DEPTH_TEST>
+    inline uint32_t evaluate(const int64_t *edge, const float z_pixel,
+                             const float *z_buffer, const size_t pixels,
+                             float *z) const;
+
+    // Same as evaluate(), but for the batches known to be inside the
+    // triangle, so only the depth test is done.
+    template <coverage::DepthTest DEPTH_TEST>
+    inline uint32_t evaluate_inside(const float z_pixel, const float *z_buffer,
+                                    const size_t pixels, float *z) const;
+
+    // Same as evaluate(), but compute the lanes from the steps directly, for
+    // the triangles evaluating too few batches to pay off a kernel. The depth
+    // of the lanes is rounded as in evaluate().
+    template <coverage::DepthTest DEPTH_TEST>
+    static inline uint32_t evaluate_once(
+        const coverage::LaneOffsets<MSAA_LEVEL> &offsets, const int64_t *edge,
+        const int64_t *edge_dx, const int64_t *edge_dy, const float z_pixel,
+        const float z_dx, const float z_dy, const float *z_buffer,
+        const size_t pixels, float *z);
+
+   private:
+    // Return the z-coordinate of the lane k relative to the center of the
+    // first pixel of the batch.
+    static inline float lane_z_offset(
+        const coverage::LaneOffsets<MSAA_LEVEL> &offsets, const size_t k,
+        const float z_dx, const float z_dy);
+
+    // Return the mask of the first `lanes` lanes whose depth `z` passes the
+    // depth test against `z_buffer`.
+    template <coverage::DepthTest DEPTH_TEST>
+    static inline uint32_t depth_mask(const float *z, const float *z_buffer,
+                                      const size_t lanes);
+};
+
+template <size_t MSAA_LEVEL>
+CoverageKernel<MSAA_LEVEL>::CoverageKernel(
+    const coverage::LaneOffsets<MSAA_LEVEL> &offsets, const int64_t *edge_dx,
+    const int64_t *edge_dy, const float z_dx, const float z_dy) {
+    for (size_t k = 0; k < coverage::LANES; k++) {
+        for (size_t j = 0; j < 3; j++) {
+            lane_edge[j][k] =
+                edge_dx[j] / coverage::SUBPIXEL_SCALE * offsets.x[k] +
+                edge_dy[j] / coverage::SUBPIXEL_SCALE * offsets.y[k];
+        }
+        lane_z[k] = lane_z_offset(offsets, k, z_dx, z_dy);
+    }
+}
+
+template <size_t MSAA_LEVEL>
+inline float CoverageKernel<MSAA_LEVEL>::lane_z_offset(
+    const coverage::LaneOffsets<MSAA_LEVEL> &offsets, const size_t k,
+    const float z_dx, const float z_dy) {
+    return z_dx * offsets.dx[k] + z_dy * offsets.dy[k];
+}
+
+template <size_t MSAA_LEVEL>
+template <coverage::DepthTest DEPTH_TEST>
+inline uint32_t CoverageKernel<MSAA_LEVEL>::evaluate(const int64_t *edge,
+                                                     const float z_pixel,
+                                                     const float *z_buffer,
+                                                     const size_t pixels,
+                                                     float *z) const {
+    const size_t lanes = pixels * MSAA_LEVEL;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    // inside test, on the lanes 0-3 and 4-7 separately
+    __m256i inside_lo = _mm256_set1_epi64x(-1);
+    __m256i inside_hi = _mm256_set1_epi64x(-1);
+    for (size_t j = 0; j < 3; j++) {
+        __m256i edge_j = _mm256_set1_epi64x(edge[j]);
+        __m256i edge_lo = _mm256_add_epi64(
+            edge_j, _mm256_load_si256(
+                        reinterpret_cast<const __m256i *>(lane_edge[j])));
+        __m256i edge_hi = _mm256_add_epi64(
+            edge_j, _mm256_load_si256(
+                        reinterpret_cast<const __m256i *>(lane_edge[j] + 4)));
+        inside_lo = _mm256_and_si256(
+            inside_lo, _mm256_cmpgt_epi64(edge_lo, _mm256_setzero_si256()));
+        inside_hi = _mm256_and_si256(
+            inside_hi, _mm256_cmpgt_epi64(edge_hi, _mm256_setzero_si256()));
+    }
+    uint32_t inside_mask =
+        _mm256_movemask_pd(_mm256_castsi256_pd(inside_lo)) |
+        (_mm256_movemask_pd(_mm256_castsi256_pd(inside_hi)) << 4);
+
+    // z
+    _mm256_storeu_ps(z, _mm256_add_ps(_mm256_set1_ps(z_pixel),
+                                      _mm256_load_ps(lane_z)));
+#else
+    uint32_t inside_mask = 0;
+    for (size_t k = 0; k < lanes; k++) {
+        z[k] = z_pixel + lane_z[k];
+        if (edge[0] + lane_edge[0][k] > 0 && edge[1] + lane_edge[1][k] > 0 &&
+            edge[2] + lane_edge[2][k] > 0) {
+            inside_mask |= 1u << k;
+        }
+    }
+#endif
+
+    return inside_mask & depth_mask<DEPTH_TEST>(z, z_buffer, lanes);
+}
+
+template <size_t MSAA_LEVEL>
+template <coverage::DepthTest DEPTH_TEST>
+inline uint32_t CoverageKernel<MSAA_LEVEL>::evaluate_inside(
+    const float z_pixel, const float *z_buffer, const size_t pixels,
+    float *z) const {
+    const size_t lanes = pixels * MSAA_LEVEL;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    _mm256_storeu_ps(z, _mm256_add_ps(_mm256_set1_ps(z_pixel),
+                                      _mm256_load_ps(lane_z)));
+#else
+    for (size_t k = 0; k < lanes; k++) z[k] = z_pixel + lane_z[k];
+#endif
+
+    return depth_mask<DEPTH_TEST>(z, z_buffer, lanes);
+}
+
+template <size_t MSAA_LEVEL>
+template <coverage::DepthTest DEPTH_TEST>
+inline uint32_t CoverageKernel<MSAA_LEVEL>::evaluate_once(
+    const coverage::LaneOffsets<MSAA_LEVEL> &offsets, const int64_t *edge,
+    const int64_t *edge_dx, const int64_t *edge_dy, const float z_pixel,
+    const float z_dx, const float z_dy, const float *z_buffer,
+    const size_t pixels, float *z) {
+    const size_t lanes = pixels * MSAA_LEVEL;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    // inside test, on the lanes 0-3 and 4-7 separately. The coefficients of
+    // the edge functions fit in 32 bits inside the guard band.
+    __m256i offset_x_lo =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(offsets.x));
+    __m256i offset_x_hi =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(offsets.x + 4));
+    __m256i offset_y_lo =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(offsets.y));
+    __m256i offset_y_hi =
+        _mm256_load_si256(reinterpret_cast<const __m256i *>(offsets.y + 4));
+
+    __m256i inside_lo = _mm256_set1_epi64x(-1);
+    __m256i inside_hi = _mm256_set1_epi64x(-1);
+    for (size_t j = 0; j < 3; j++) {
+        __m256i edge_j = _mm256_set1_epi64x(edge[j]);
+        __m256i coef_x =
+            _mm256_set1_epi64x(edge_dx[j] / coverage::SUBPIXEL_SCALE);
+        __m256i coef_y =
+            _mm256_set1_epi64x(edge_dy[j] / coverage::SUBPIXEL_SCALE);
+        __m256i edge_lo = _mm256_add_epi64(
+            edge_j, _mm256_add_epi64(_mm256_mul_epi32(coef_x, offset_x_lo),
+                                     _mm256_mul_epi32(coef_y, offset_y_lo)));
+        __m256i edge_hi = _mm256_add_epi64(
+            edge_j, _mm256_add_epi64(_mm256_mul_epi32(coef_x, offset_x_hi),
+                                     _mm256_mul_epi32(coef_y, offset_y_hi)));
+        inside_lo = _mm256_and_si256(
+            inside_lo, _mm256_cmpgt_epi64(edge_lo, _mm256_setzero_si256()));
+        inside_hi = _mm256_and_si256(
+            inside_hi, _mm256_cmpgt_epi64(edge_hi, _mm256_setzero_si256()));
+    }
+    uint32_t inside_mask =
+        _mm256_movemask_pd(_mm256_castsi256_pd(inside_lo)) |
+        (_mm256_movemask_pd(_mm256_castsi256_pd(inside_hi)) << 4);
+
+    // z
+    alignas(32) float lane_z[coverage::LANES];
+    for (size_t k = 0; k < coverage::LANES; k++) {
+        lane_z[k] = lane_z_offset(offsets, k, z_dx, z_dy);
+    }
+    _mm256_storeu_ps(z, _mm256_add_ps(_mm256_set1_ps(z_pixel),
+                                      _mm256_load_ps(lane_z)));
+#else
+    uint32_t inside_mask = 0;
+    for (size_t k = 0; k < lanes; k++) {
+        z[k] = z_pixel + lane_z_offset(offsets, k, z_dx, z_dy);
+        bool inside = true;
+        for (size_t j = 0; j < 3; j++) {
+            int64_t coef_x = edge_dx[j] / coverage::SUBPIXEL_SCALE;
+            int64_t coef_y = edge_dy[j] / coverage::SUBPIXEL_SCALE;
+            int64_t edge_k =
+                edge[j] + coef_x * offsets.x[k] + coef_y * offsets.y[k];
+            inside = inside && edge_k > 0;
+        }
+        if (inside) inside_mask |= 1u << k;
+    }
+#endif
+
+    return inside_mask & depth_mask<DEPTH_TEST>(z, z_buffer, lanes);
+}
+
+template <size_t MSAA_LEVEL>
+template <coverage::DepthTest DEPTH_TEST>
+inline uint32_t CoverageKernel<MSAA_LEVEL>::depth_mask(const float *z,
+                                                       const float *z_buffer,
+                                                       const size_t lanes) {
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 z_lanes = _mm256_loadu_ps(z);
+    __m256 z_buffer_lanes;
+    if (lanes == coverage::LANES) {
+        z_buffer_lanes = _mm256_loadu_ps(z_buffer);
+    } else {  // do not read beyond the last pixel
+        __m256i valid =
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes),
+                               _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        z_buffer_lanes = _mm256_maskload_ps(z_buffer, valid);
+    }
+    __m256 mask = _mm256_and_ps(
+        _mm256_cmp_ps(z_lanes, _mm256_setzero_ps(), _CMP_GT_OQ),
+        _mm256_cmp_ps(
+            z_lanes, z_buffer_lanes,
+            DEPTH_TEST == coverage::DEPTH_LESS ? _CMP_LT_OQ : _CMP_LE_OQ));
+
+    return _mm256_movemask_ps(mask) & ((1u << lanes) - 1);
+#else
+    uint32_t mask = 0;
+    for (size_t k = 0; k < lanes; k++) {
+        bool depth_passed = DEPTH_TEST == coverage::DEPTH_LESS
+                                ? z[k] < z_buffer[k]
+                                : z[k] <= z_buffer[k];
+        if (0.f < z[k] && depth_passed) mask |= 1u << k;
+    }
+    return mask;
+#endif
+}
+
+#endif
@@ -0,0 +1,299 @@
+#pragma once
+#ifndef HI_Z_BUFFER_H
+#define HI_Z_BUFFER_H
+
+#include <algorithm>
+#include <memory>
+#include <tuple>
+
+#include "global.hpp"
+#include "rasterizer/coverage_kernel.hpp"
+#include "rasterizer/tile.hpp"
+#include "texture/buffer.hpp"
+#include "texture/texture.hpp"
+
+namespace hi_z {
+// Width and height of a hierarchical z block in pixels.
+const int BLOCK_SIZE = 8;
+static_assert(tile::TILE_SIZE % BLOCK_SIZE == 0);
+}  // namespace hi_z
+
+// Depth plane of a triangle, with the depth `z` at the center of the pixel
+// (x, y) and the steps per pixel.
+class DepthPlane {
+   public:
+    float z;
+    float z_dx;
+    float z_dy;
+    int x;
+    int y;
+};
+
+// Coarse per-block minimum and maximum depth of the z-buffer, used to reject
+// triangles and blocks behind the already written geometry before any
+// per-sample work, and the plane compression of the blocks.
+//
+// The depth range of a block is refreshed lazily: writing into the z-buffer
+// only marks the block as dirty, and the range is recomputed when queried.
+// Since the z-buffer is only decreased, a stale maximum is still conservative.
+// Blocks lie inside tiles, so a block is only accessed by the thread owning
+// its tile.
+//
+// A block covered entirely by a triangle in front of all its samples is
+// compressed: only the depth plane of the triangle is kept, and the samples
+// in the z-buffer are stale until the block is decompressed, e.g. before a
+// triangle covering it partially is rasterized. The plane is evaluated
+// exactly as the traversal evaluates it, see Triangle::traverse(), so the
+// decompressed samples are the ones the traversal would have written.
+template <size_t MSAA_LEVEL>
+class HiZBuffer {
+   public:
+    size_t blocks_x;
+    size_t blocks_y;
+
+   private:
+    std::shared_ptr<z_buffer_t<MSAA_LEVEL>> z_buffer;
+    const coverage::LaneOffsets<MSAA_LEVEL> *lane_offsets;
+
+    Texture<float> min_z_buffer;
+    Texture<float> max_z_buffer;
+    Texture<bool> dirty;
+
+    // plane of the compressed blocks
+    Texture<bool> compressed;
+    Texture<DepthPlane> planes;
+
+   public:
+    // `lane_offsets` are the offsets of the samples of the rasterization, see
+    // Buffer.
+    HiZBuffer(const std::shared_ptr<z_buffer_t<MSAA_LEVEL>> &z_buffer,
+              const coverage::LaneOffsets<MSAA_LEVEL> *lane_offsets);
+
+    // Return the minimum depth of the block.
+    float block_min_z(const size_t block_x, const size_t block_y);
+
+    // Return the maximum depth of the block.
+    float block_max_z(const size_t block_x, const size_t block_y);
+
+    // Return the maximum depth of all blocks overlapping the pixel range
+    // [min_x, max_x) x [min_y, max_y).
+    float max_z(const int min_x, const int min_y, const int max_x,
+                const int max_y);
+
+    // Mark the block containing the pixel as modified.
+    inline void mark_dirty(const int pixel_x, const int pixel_y);
+
+    // Return the pixel range [min_x, max_x) x [min_y, max_y) of the block.
+    std::tuple<int, int, int, int> block_range(const size_t block_x,
+                                               const size_t block_y) const;
+
+    // Compress the block into the plane, where `min_z` and `max_z` are the
+    // depth range of its samples. The block must be covered entirely by the
+    // plane.
+    void compress(const size_t block_x, const size_t block_y,
+                  const DepthPlane &plane, const float min_z,
+                  const float max_z);
+
+    // Write the samples of the block containing the pixel into the z-buffer
+    // if it is compressed, before the z-buffer of the block is read or
+    // written directly.
+    inline void decompress(const int pixel_x, const int pixel_y);
+
+    // Return the depth of each pixel, averaging its samples as
+    // msaa::msaa_filter() does, and write the flags of its samples at the
+    // background, i.e. with depth greater than 1 - EPS, into
+    // `background_flag`. The compressed blocks are evaluated from their
+    // planes without decompression.
+    Texture<float> resolve(const Texture<bool> &full_covered,
+                           Texture<unsigned char> *background_flag) const;
+
+   private:
+    // Recompute the depth range of the block if dirty.
+    void refresh(const size_t block_x, const size_t block_y);
+
+    // Call `func(pixel_x, pixel_y, z)` for each pixel of the compressed block,
+    // where `z` points to the depth of its samples evaluated from the plane.
+    template <typename FuncT>
+    void for_each_plane_pixel(const size_t block_x, const size_t block_y,
+                              FuncT &&func) const;
+};
+
+template <size_t MSAA_LEVEL>
+HiZBuffer<MSAA_LEVEL>::HiZBuffer(
+    const std::shared_ptr<z_buffer_t<MSAA_LEVEL>> &z_buffer,
+    const coverage::LaneOffsets<MSAA_LEVEL> *lane_offsets) {
+    this->z_buffer = z_buffer;
+    this->lane_offsets = lane_offsets;
+    blocks_x = (z_buffer->width + hi_z::BLOCK_SIZE - 1) / hi_z::BLOCK_SIZE;
+    blocks_y = (z_buffer->height + hi_z::BLOCK_SIZE - 1) / hi_z::BLOCK_SIZE;
+    min_z_buffer = Texture<float>(blocks_x, blocks_y, 0.f);
+    max_z_buffer = Texture<float>(blocks_x, blocks_y, 0.f);
+    dirty = Texture<bool>(blocks_x, blocks_y, true);
+    compressed = Texture<bool>(blocks_x, blocks_y, false);
+    planes = Texture<DepthPlane>(blocks_x, blocks_y);
+}
+
+template <size_t MSAA_LEVEL>
+float HiZBuffer<MSAA_LEVEL>::block_min_z(const size_t block_x,
+                                         const size_t block_y) {
+    refresh(block_x, block_y);
+    return min_z_buffer.at(block_x, block_y);
+}
+
+template <size_t MSAA_LEVEL>
+float HiZBuffer<MSAA_LEVEL>::block_max_z(const size_t block_x,
+                                         const size_t block_y) {
+    refresh(block_x, block_y);
+    return max_z_buffer.at(block_x, block_y);
+}
+
+template <size_t MSAA_LEVEL>
+float HiZBuffer<MSAA_LEVEL>::max_z(const int min_x, const int min_y,
+                                   const int max_x, const int max_y) {
+    float max_z = 0.f;
+    for (int block_y = min_y / hi_z::BLOCK_SIZE;
+         block_y <= (max_y - 1) / hi_z::BLOCK_SIZE; block_y++) {
+        for (int block_x = min_x / hi_z::BLOCK_SIZE;
+             block_x <= (max_x - 1) / hi_z::BLOCK_SIZE; block_x++) {
+            max_z = std::max(max_z, block_max_z(block_x, block_y));
+        }
+    }
+    return max_z;
+}
+
+template <size_t MSAA_LEVEL>
+inline void HiZBuffer<MSAA_LEVEL>::mark_dirty(const int pixel_x,
+                                              const int pixel_y) {
+    dirty.at(pixel_x / hi_z::BLOCK_SIZE, pixel_y / hi_z::BLOCK_SIZE) = true;
+}
+
+template <size_t MSAA_LEVEL>
+std::tuple<int, int, int, int> HiZBuffer<MSAA_LEVEL>::block_range(
+    const size_t block_x, const size_t block_y) const {
+    int min_x = block_x * hi_z::BLOCK_SIZE;
+    int min_y = block_y * hi_z::BLOCK_SIZE;
+    int max_x = std::min<int>(min_x + hi_z::BLOCK_SIZE, z_buffer->width);
+    int max_y = std::min<int>(min_y + hi_z::BLOCK_SIZE, z_buffer->height);
+    return {min_x, min_y, max_x, max_y};
+}
+
+template <size_t MSAA_LEVEL>
+void HiZBuffer<MSAA_LEVEL>::compress(const size_t block_x,
+                                     const size_t block_y,
+                                     const DepthPlane &plane,
+                                     const float min_z, const float max_z) {
+    compressed.at(block_x, block_y) = true;
+    planes.at(block_x, block_y) = plane;
+    min_z_buffer.at(block_x, block_y) = min_z;
+    max_z_buffer.at(block_x, block_y) = max_z;
+    dirty.at(block_x, block_y) = false;
+}
+
+template <size_t MSAA_LEVEL>
+inline void HiZBuffer<MSAA_LEVEL>::decompress(const int pixel_x,
+                                              const int pixel_y) {
+    size_t block_x = pixel_x / hi_z::BLOCK_SIZE;
+    size_t block_y = pixel_y / hi_z::BLOCK_SIZE;
+    if (!compressed.at(block_x, block_y)) return;
+
+    for_each_plane_pixel(
+        block_x, block_y,
+        [&](const int x, const int y, const float *z) {
+            std::copy(z, z + MSAA_LEVEL, z_buffer->at(x, y).data());
+        });
+    compressed.at(block_x, block_y) = false;
+}
+
+template <size_t MSAA_LEVEL>
+Texture<float> HiZBuffer<MSAA_LEVEL>::resolve(
+    const Texture<bool> &full_covered,
+    Texture<unsigned char> *background_flag) const {
+    Texture<float> res(z_buffer->width, z_buffer->height);
+
+    auto resolve_pixel = [&](const int x, const int y, const float *z) {
+        unsigned char flag = 0;
+        float sum = 0;
+        for (size_t i = 0; i < MSAA_LEVEL; i++) {
+            if (z[i] > 1.f - EPS) flag |= 1u << i;
+            sum += z[i];
+        }
+        background_flag->at(x, y) = flag;
+        res.at(x, y) = full_covered.at(x, y) ? z[0] : sum / MSAA_LEVEL;
+    };
+
+#pragma omp parallel for
+    for (size_t block_y = 0; block_y < blocks_y; block_y++) {
+        for (size_t block_x = 0; block_x < blocks_x; block_x++) {
+            if (compressed.at(block_x, block_y)) {
+                for_each_plane_pixel(block_x, block_y, resolve_pixel);
+                continue;
+            }
+
+            auto [min_x, min_y, max_x, max_y] = block_range(block_x, block_y);
+            for (int y = min_y; y < max_y; y++) {
+                for (int x = min_x; x < max_x; x++) {
+                    resolve_pixel(x, y, z_buffer->at(x, y).data());
+                }
+            }
+        }
+    }
+
+    return res;
+}
+
+template <size_t MSAA_LEVEL>
+void HiZBuffer<MSAA_LEVEL>::refresh(const size_t block_x,
+                                    const size_t block_y) {
+    if (!dirty.at(block_x, block_y)) return;
+
+    auto [min_x, min_y, max_x, max_y] = block_range(block_x, block_y);
+    float min_z = 1.f;
+    float max_z = 0.f;
+    for (int y = min_y; y < max_y; y++) {
+        const float *z = z_buffer->at(min_x, y).data();
+        for (size_t i = 0; i < (max_x - min_x) * MSAA_LEVEL; i++) {
+            min_z = std::min(min_z, z[i]);
+            max_z = std::max(max_z, z[i]);
+        }
+    }
+
+    min_z_buffer.at(block_x, block_y) = min_z;
+    max_z_buffer.at(block_x, block_y) = max_z;
+    dirty.at(block_x, block_y) = false;
+}
+
+template <size_t MSAA_LEVEL>
+template <typename FuncT>
+void HiZBuffer<MSAA_LEVEL>::for_each_plane_pixel(const size_t block_x,
+                                                 const size_t block_y,
+                                                 FuncT &&func) const {
+    constexpr size_t BATCH_PIXELS = coverage::BATCH_PIXELS<MSAA_LEVEL>;
+
+    // depth of the far plane, as the depth test of the kernel is not used
+    static const auto far_z = msaa::texture_init_val<coverage::LANES>(1.f);
+    static const int64_t no_edge[3] = {0, 0, 0};
+
+    const DepthPlane &plane = planes.at(block_x, block_y);
+    auto coverage_kernel = CoverageKernel<MSAA_LEVEL>(
+        *lane_offsets, no_edge, no_edge, plane.z_dx, plane.z_dy);
+
+    auto [min_x, min_y, max_x, max_y] = block_range(block_x, block_y);
+    for (int pixel_y = min_y; pixel_y < max_y; pixel_y++) {
+        float z_x = plane.z + plane.z_dx * (min_x - plane.x) +
+                    plane.z_dy * (pixel_y - plane.y);
+        for (int batch_x = min_x; batch_x < max_x; batch_x += BATCH_PIXELS) {
+            size_t batch_pixels =
+                std::min<size_t>(BATCH_PIXELS, max_x - batch_x);
+            float z_samples[coverage::LANES];
+            coverage_kernel.template evaluate_inside<coverage::DEPTH_LESS>(
+                z_x, far_z.data(), batch_pixels, z_samples);
+            for (size_t p = 0; p < batch_pixels; p++) {
+                func(batch_x + p, pixel_y, z_samples + p * MSAA_LEVEL);
+            }
+
+            z_x += plane.z_dx * BATCH_PIXELS;
+        }
+    }
+}
+
+#endif
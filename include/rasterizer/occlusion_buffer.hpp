@@ -0,0 +1,73 @@
+#pragma once
+#ifndef OCCLUSION_BUFFER_H
+#define OCCLUSION_BUFFER_H
+
+#include <vector>
+
+#include "geometry/triangle.hpp"
+#include "scene/camera.hpp"
+#include "texture/texture.hpp"
+
+namespace occlusion {
+// Width and height of a cell of the occlusion buffer in pixels.
+const int CELL_SIZE = 8;
+
+// Maximum number of occluders rasterized per frame, taken from the largest.
+const size_t MAX_OCCLUDERS = 4096;
+
+// Bias added to the depth of the occluders against the rounding errors.
+const float DEPTH_BIAS = 1e-6f;
+}  // namespace occlusion
+
+// Screen-space bounding box of a group of triangles, with the nearest depth.
+class ScreenBounds {
+   public:
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+    float min_z;
+
+    ScreenBounds();
+
+    // Extend the bounds by the vertices of the triangle.
+    void extend(const Triangle &triangle);
+};
+
+// Low-resolution conservative depth buffer built from the largest occluders
+// before the rasterization, to reject groups of triangles hidden behind them
+// without any per-triangle work.
+//
+// A cell only takes the depth of an occluder covering it entirely, and the
+// depth is the farthest point of the occluder inside the cell, so every
+// sample of the cell is at least as near after the rasterization.
+class OcclusionBuffer {
+   private:
+    int cells_x;
+    int cells_y;
+
+    // row of the frame at the top of the cells, see Camera::band()
+    int offset_y;
+
+    // upper bound of the depth of each cell, 1 if not covered
+    Texture<float> max_z;
+
+   public:
+    // Build the buffer from the occluders among the visible triangles.
+    OcclusionBuffer(const Camera &camera,
+                    const std::vector<Triangle *> &triangles);
+
+    // Return if all samples inside the bounds are behind the occluders.
+    bool is_occluded(const ScreenBounds &bounds) const;
+
+   private:
+    // Return if every sample the triangle covers is written by the back-face
+    // culled rasterization, i.e. it is opaque and, with the vertex normals,
+    // faces the camera at any point.
+    static bool is_occluder(const Triangle &triangle, const Camera &camera);
+
+    // Write the depth of the cells covered entirely by the triangle.
+    void rasterize(const Triangle &triangle);
+};
+
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+#ifndef SETUP_BUFFER_H
+#define SETUP_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "global.hpp"
+
+class Triangle;
+
+namespace setup_buffer {
+// Minimum number of records the arrays grow by, once full.
+const size_t MIN_CAPACITY = 1024;
+}  // namespace setup_buffer
+
+// Per-triangle data prepared for the traversal, stored as structure of
+// arrays. The record at index i belongs to `triangles[i]`.
+//
+// The planes are relative to the pixel center (min_x, plane_y), i.e. the
+// value at the pixel center (x, y) is
+// p + p_dx * (x - min_x) + p_dy * (y - plane_y).
+//
+// The records hold what the traversal steps per pixel: the bounding box, the
+// edge functions and the barycentric and depth planes. The derivatives used
+// per sample and for shading, i.e. the barycentric offsets of the MSAA
+// samples, the uv derivatives and the tangent, stay in the Triangle, as the
+// deferred shading reaches the triangles through the visibility buffer
+// without their records.
+class SetupBuffer {
+   public:
+    std::vector<Triangle *> triangles;
+
+    // submission order of the triangle, the key of the deterministic order
+    std::vector<uint32_t> order;
+
+    // pixel range [min_x, max_x) x [min_y, max_y) covered by the triangle,
+    // clamped to the screen
+    std::vector<int> min_x;
+    std::vector<int> min_y;
+    std::vector<int> max_x;
+    std::vector<int> max_y;
+
+    // row of the planes, the top of the triangle clamped to the frame rather
+    // than to the band, so that a band evaluates the planes as the whole
+    // frame does, see Camera::band()
+    std::vector<int> plane_y;
+
+    // fixed-point edge functions of the three edges, relative to the top-left
+    // corner of the pixel (min_x, min_y), and their steps per pixel. A sample
+    // is inside the triangle if all edge functions are positive.
+    std::vector<int64_t> edge[3];
+    std::vector<int64_t> edge_dx[3];
+    std::vector<int64_t> edge_dy[3];
+
+    // screen-space barycentric coordinate plane
+    std::vector<float> w1, w1_dx, w1_dy;
+    std::vector<float> w2, w2_dx, w2_dy;
+    std::vector<float> w3, w3_dx, w3_dy;
+
+    // screen-space z plane, and the minimum z of the vertices
+    std::vector<float> z, z_dx, z_dy;
+    std::vector<float> min_z;
+
+    size_t size() const;
+
+    // Remove all records, keeping the allocated space.
+    void clear();
+
+    // Append a record of the triangle, and return its index. The other fields
+    // of the record are left to the caller. The arrays grow by whole chunks
+    // of records, so that each append does not resize all of them.
+    size_t append(Triangle *triangle);
+
+    void set_barycoord(const size_t index, const vec3 &barycoord,
+                       const vec3 &barycoord_dx, const vec3 &barycoord_dy);
+
+    vec3 barycoord(const size_t index) const;
+    vec3 barycoord_dx(const size_t index) const;
+    vec3 barycoord_dy(const size_t index) const;
+
+   private:
+    // number of records, while the arrays are sized to the capacity
+    size_t records_num = 0;
+
+    // Call `func(array)` for each array of the records.
+    template <typename FuncT>
+    void for_each_array(FuncT &&func);
+};
+
+template <typename FuncT>
+void SetupBuffer::for_each_array(FuncT &&func) {
+    func(triangles);
+    func(order);
+    for (auto array : {&min_x, &min_y, &max_x, &max_y, &plane_y}) {
+        func(*array);
+    }
+    for (size_t k = 0; k < 3; k++) {
+        func(edge[k]);
+        func(edge_dx[k]);
+        func(edge_dy[k]);
+    }
+    for (auto array : {&w1, &w1_dx, &w1_dy, &w2, &w2_dx, &w2_dy, &w3, &w3_dx,
+                       &w3_dy, &z, &z_dx, &z_dy, &min_z}) {
+        func(*array);
+    }
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+#ifndef TILE_H
+#define TILE_H
+
+namespace tile {
+// Width and height of a screen tile in pixels.
+const int TILE_SIZE = 32;
+}  // namespace tile
+
+// A rectangle of pixels [min_x, max_x) x [min_y, max_y) in the screen space.
+class Tile {
+   public:
+    int min_x;
+    int min_y;
+    int max_x;
+    int max_y;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#pragma once
+#ifndef TILE_BINS_H
+#define TILE_BINS_H
+
+#include <omp.h>
+
+#include <cstdint>
+#include <queue>
+#include <type_traits>
+#include <vector>
+
+#include "geometry/triangle.hpp"
+#include "rasterizer/coverage_kernel.hpp"
+#include "rasterizer/setup_buffer.hpp"
+#include "rasterizer/tile.hpp"
+#include "scene/camera.hpp"
+#include "shader/fragment_shader.hpp"
+#include "texture/buffer.hpp"
+
+// Sort-middle binning of triangles into screen tiles.
+//
+// Triangles are set up and binned in parallel, each thread appending into its
+// own setup buffer and set of bins, where the bins hold the indices of the
+// setup records. At the rasterization stage, each tile is owned by exactly one
+// thread, so the depth test and the buffer writes need no locks.
+//
+// The bin of each thread is in the order of submission, but the threads take
+// the triangles dynamically, so the bins of a tile are interleaved differently
+// from run to run. In the deterministic mode, the bins of each tile are merged
+// by the submission order of the setup records, so that fragments at equal
+// depth are resolved as in a single-threaded run regardless of the threads.
+class TileBins {
+   public:
+    int tiles_x;
+    int tiles_y;
+
+   private:
+    int width;
+    int height;
+    bool deterministic;
+
+    // setup_buffers[thread_id]
+    std::vector<SetupBuffer> setup_buffers;
+
+    // bins[thread_id][tile_id]
+    std::vector<std::vector<std::vector<uint32_t>>> bins;
+
+   public:
+    TileBins(const Camera &camera, const bool deterministic = false);
+
+    // Remove all binned triangles and setup records, keeping the allocated
+    // space.
+    void clear();
+
+    // Set up the triangle not culled, and append it into the bins of all
+    // tiles its bounding box covers, where `order` is its position in the
+    // submission order. Thread-safe.
+    void bin(Triangle *triangle, const uint32_t order, const Camera &camera);
+
+    template <size_t MSAA_LEVEL, typename FragmentShaderT>
+    void rasterize(Buffer<MSAA_LEVEL> *buffer, FragmentShaderT *fragment_shader,
+                   const Camera &camera, Triangle::CullMethod cull_method,
+                   coverage::DepthTest depth_test = coverage::DEPTH_LESS);
+
+    // Rasterize into the z-buffer and the visibility buffer without shading.
+    template <size_t MSAA_LEVEL>
+    void rasterize_visibility(
+        Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+        Triangle::CullMethod cull_method,
+        coverage::DepthTest depth_test = coverage::DEPTH_LESS);
+
+    // Rasterize into the z-buffer only.
+    template <size_t MSAA_LEVEL>
+    void rasterize_depth(Buffer<MSAA_LEVEL> *buffer, const Camera &camera,
+                         Triangle::CullMethod cull_method);
+
+   private:
+    Tile tile(const int tile_id) const;
+
+    // Call `func(setups, index, tile)` for each binned triangle of each tile,
+    // where `index` is the index of its setup record in `setups`, in parallel
+    // over the tiles.
+    template <typename FuncT>
+    void for_each_binned(FuncT &&func);
+
+    // Call `func(setups, index, tile)` for each binned triangle of the tile in
+    // the submission order, by a k-way merge of the bins of all threads with
+    // a min-heap, i.e. O(log(threads)) per record.
+    template <typename FuncT>
+    void for_each_binned_ordered(const int tile_id, const Tile &tile,
+                                 FuncT &&func);
+};
+
+template <size_t MSAA_LEVEL, typename FragmentShaderT>
+void TileBins::rasterize(Buffer<MSAA_LEVEL> *buffer,
+                         FragmentShaderT *fragment_shader,
+                         const Camera &camera,
+                         Triangle::CullMethod cull_method,
+                         coverage::DepthTest depth_test) {
+    static_assert(std::is_base_of_v<FragmentShader, FragmentShaderT>);
+
+    for_each_binned(
+        [&](const SetupBuffer &setups, const size_t index, const Tile &tile) {
+            setups.triangles[index]->rasterize(buffer, fragment_shader, camera,
+                                               setups, index, tile,
+                                               cull_method, depth_test);
+        });
+}
+
+template <size_t MSAA_LEVEL>
+void TileBins::rasterize_visibility(Buffer<MSAA_LEVEL> *buffer,
+                                    const Camera &camera,
+                                    Triangle::CullMethod cull_method,
+                                    coverage::DepthTest depth_test) {
+    for_each_binned(
+        [&](const SetupBuffer &setups, const size_t index, const Tile &tile) {
+            setups.triangles[index]->rasterize_visibility(
+                buffer, camera, setups, index, tile, cull_method, depth_test);
+        });
+}
+
+template <size_t MSAA_LEVEL>
+void TileBins::rasterize_depth(Buffer<MSAA_LEVEL> *buffer,
+                               const Camera &camera,
+                               Triangle::CullMethod cull_method) {
+    for_each_binned(
+        [&](const SetupBuffer &setups, const size_t index, const Tile &tile) {
+            setups.triangles[index]->rasterize_depth(buffer, camera, setups,
+                                                     index, tile, cull_method);
+        });
+}
+
+template <typename FuncT>
+void TileBins::for_each_binned(FuncT &&func) {
+#pragma omp parallel for schedule(dynamic)
+    for (int tile_id = 0; tile_id < tiles_x * tiles_y; tile_id++) {
+        Tile tile = this->tile(tile_id);
+        if (deterministic) {
+            for_each_binned_ordered(tile_id, tile, func);
+            continue;
+        }
+        for (size_t thread_id = 0; thread_id < bins.size(); thread_id++) {
+            const auto &thread_setups = setup_buffers[thread_id];
+            for (auto index : bins[thread_id][tile_id]) {
+                func(thread_setups, index, tile);
+            }
+        }
+    }
+}
+
+template <typename FuncT>
+void TileBins::for_each_binned_ordered(const int tile_id, const Tile &tile,
+                                       FuncT &&func) {
+    // the bins of the tile not exhausted, with their next position and the
+    // submission order of the record there
+    class Cursor {
+       public:
+        size_t thread_id;
+        size_t pos;
+        uint32_t order;
+    };
+
+    // the bin whose next record is the earliest submitted on top
+    auto later = [](const Cursor &a, const Cursor &b) {
+        return a.order > b.order;
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> cursors(
+        later);
+    for (size_t thread_id = 0; thread_id < bins.size(); thread_id++) {
+        const auto &bin = bins[thread_id][tile_id];
+        if (!bin.empty()) {
+            cursors.push(
+                {thread_id, 0, setup_buffers[thread_id].order[bin[0]]});
+        }
+    }
+
+    while (!cursors.empty()) {
+        Cursor cursor = cursors.top();
+        cursors.pop();
+
+        const auto &thread_setups = setup_buffers[cursor.thread_id];
+        const auto &bin = bins[cursor.thread_id][tile_id];
+        func(thread_setups, bin[cursor.pos], tile);
+        if (++cursor.pos < bin.size()) {
+            cursor.order = thread_setups.order[bin[cursor.pos]];
+            cursors.push(cursor);
+        }
+    }
+}
+
+#endif
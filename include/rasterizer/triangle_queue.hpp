@@ -0,0 +1,111 @@
+#pragma once
+#ifndef TRIANGLE_QUEUE_H
+#define TRIANGLE_QUEUE_H
+
+#include <omp.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "geometry/cluster.hpp"
+#include "geometry/triangle.hpp"
+#include "scene/camera.hpp"
+
+namespace triangle_queue {
+// Maximum number of triangles in a batch, the unit of work taken by a thread.
+const size_t BATCH_SIZE = 256;
+static_assert(cluster::MAX_TRIANGLES <= BATCH_SIZE);
+}  // namespace triangle_queue
+
+// Scene-wide pool of triangle batches over all objects and shapes.
+//
+// The triangles of all shapes are split into batches of at most
+// triangle_queue::BATCH_SIZE, and the batches are taken by the threads
+// dynamically in a single parallel loop, so there is no barrier per shape and
+// the load balance does not depend on how the model is split into shapes.
+//
+// The triangles are culled by a separate pass, which compacts the survivors
+// into a list in their original order, so that the later passes iterate only
+// the visible triangles. A batch pushed as a cluster is first tested against
+// its bounds, and all its triangles are culled at once if they are outside
+// the view or face away. The survivors may be culled again per batch by an
+// occlusion buffer; batches never span shapes, so a small shape is tested as
+// a whole.
+class TriangleQueue {
+   private:
+    // triangles [first, first + size)
+    class Batch {
+       public:
+        Triangle *first;
+        size_t size;
+
+        // world-space bounds of the triangles, if pushed as a cluster
+        bool has_bounds;
+        ClusterBounds bounds;
+    };
+
+    std::vector<Batch> batches;
+    size_t triangles_num = 0;
+
+    // triangles not culled by the last cull()
+    std::vector<Triangle *> visible;
+    // the survivors of batch i are visible[visible_offsets[i],
+    // visible_offsets[i + 1])
+    std::vector<size_t> visible_offsets;
+
+   public:
+    // Remove all triangles.
+    void clear();
+
+    // Append the triangles [first, first + size), e.g. of a shape, as
+    // batches. The triangles must not be reallocated while they are in the
+    // queue.
+    void push(Triangle *first, const size_t size);
+
+    // Append the triangles [first, first + size) of a cluster as a single
+    // batch, with the world-space bounds of their vertices, see
+    // Object::world_bounds(). The size is at most triangle_queue::BATCH_SIZE.
+    void push(Triangle *first, const size_t size, const ClusterBounds &bounds);
+
+    // Number of triangles in the queue.
+    size_t size() const;
+
+    // Number of triangles not culled by the last cull().
+    size_t visible_size() const;
+
+    // Return the triangle at the position `order` among the triangles not
+    // culled, see for_each_visible().
+    Triangle *visible_at(const size_t order) const;
+
+    // Cull all triangles in the queue in parallel, see Triangle::is_culled(),
+    // and keep the survivors. The clusters are tested against their bounds
+    // first. Return the number of clusters culled as a whole.
+    size_t cull(const Camera &camera, Triangle::CullMethod cull_method);
+
+    // Cull the batches of the survivors hidden behind the largest survivors,
+    // see OcclusionBuffer, only valid after back-face culling. Return the
+    // number of batches culled.
+    size_t cull_occluded(const Camera &camera);
+
+    // Call `func(triangle, order)` for each triangle not culled by the last
+    // cull(), in parallel, where `order` is its position among them, i.e. the
+    // order of submission.
+    template <typename FuncT>
+    void for_each_visible(FuncT &&func);
+};
+
+template <typename FuncT>
+void TriangleQueue::for_each_visible(FuncT &&func) {
+#pragma omp parallel for schedule(dynamic)
+    for (size_t begin = 0; begin < visible.size();
+         begin += triangle_queue::BATCH_SIZE) {
+        size_t end =
+            std::min(begin + triangle_queue::BATCH_SIZE, visible.size());
+        for (size_t i = begin; i < end; i++) {
+            func(visible[i], i);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef VISIBILITY_BUFFER_H
+#define VISIBILITY_BUFFER_H
+
+#include <algorithm>
+#include <type_traits>
+
+#include "effects/msaa.hpp"
+#include "geometry/triangle.hpp"
+#include "rasterizer/tile.hpp"
+#include "scene/camera.hpp"
+#include "shader/fragment_shader.hpp"
+#include "texture/buffer.hpp"
+
+namespace visibility {
+
+// Shade each visible pixel of the visibility buffer exactly once per visible
+// triangle, and write the results into the buffer.
+template <size_t MSAA_LEVEL, typename FragmentShaderT>
+void resolve(Buffer<MSAA_LEVEL> *buffer, FragmentShaderT *fragment_shader,
+             const Camera &camera) {
+    static_assert(std::is_base_of_v<FragmentShader, FragmentShaderT>);
+
+    auto visibility_buffer = buffer->visibility_buffer.get();
+
+    // each band of tile rows is shaded by a single thread, see
+    // CompressedMsaaTexture
+#pragma omp parallel for schedule(dynamic)
+    for (size_t band_y = 0; band_y < visibility_buffer->height;
+         band_y += tile::TILE_SIZE) {
+        size_t band_max_y = std::min<size_t>(band_y + tile::TILE_SIZE,
+                                             visibility_buffer->height);
+        for (size_t y = band_y; y < band_max_y; y++) {
+            for (size_t x = 0; x < visibility_buffer->width; x++) {
+                auto &samples = visibility_buffer->at(x, y);
+
+                // for each visible triangle in the pixel
+                unsigned char shaded_flag = 0;
+                for (size_t i = 0; i < MSAA_LEVEL; i++) {
+                    if (samples[i] == nullptr || (shaded_flag & (1u << i)))
+                        continue;
+
+                    unsigned char covered_flag = 0;
+                    for (size_t j = i; j < MSAA_LEVEL; j++) {
+                        if (samples[j] == samples[i]) covered_flag |= 1u << j;
+                    }
+                    shaded_flag |= covered_flag;
+
+                    samples[i]->shade_visible(buffer, fragment_shader,
+                                              camera, x, y, covered_flag);
+                }
+            }
+        }
+    }
+}
+
+}  // namespace visibility
+
+#endif
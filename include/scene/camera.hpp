@@ -12,14 +12,25 @@ class Camera {
     float fov;
     float near_plane;
     float far_plane;
+    // size of the rendered image, which is a band of the frame for a band
+    // camera
     int width;
     int height;
     float aspect;
 
+    // height of the whole frame, and the row of the frame at the top of the
+    // rendered image
+    int frame_height;
+    int offset_y = 0;
+
     Camera();
     Camera(const vec3 &pos, const vec3 &rotation, const float fov,
            const float near_plane, const float far_plane, const int width,
            const int height);
+
+    // Return the camera rendering only the rows [min_y, max_y) of the frame,
+    // with the same projection.
+    Camera band(const int min_y, const int max_y) const;
 };
 
 #endif
\ No newline at end of file
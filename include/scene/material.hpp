@@ -6,6 +6,7 @@
 #include <string>
 
 #include "global.hpp"
+#include "texture/alpha_hierarchy.hpp"
 #include "texture/mipmap.hpp"
 #include "texture/texture.hpp"
 
@@ -29,6 +30,8 @@ class Material {
     std::shared_ptr<Mipmap<vec3>> specular_texture;
     std::shared_ptr<Mipmap<float>> bump_texture;
     std::shared_ptr<Texture<float>> alpha_texture;
+    // min/max hierarchy of alpha_texture
+    std::shared_ptr<AlphaHierarchy> alpha_hierarchy;
 
     // std::string ambient_texname;
     // std::string diffuse_texname;
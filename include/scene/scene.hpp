@@ -4,6 +4,7 @@
 
 #include <vector>
 
+#include "effects/msaa.hpp"
 #include "geometry/object.hpp"
 #include "light/light.hpp"
 #include "scene/camera.hpp"
@@ -17,8 +18,19 @@ class Scene {
 
     // global config
     vec3 background_color = vec3(0, 0, 0);
+    size_t msaa_level = 4;
+    msaa::SamplePattern msaa_pattern = msaa::GRID;
+    bool enable_deterministic = false;
+    bool enable_occlusion_culling = false;
+    bool enable_z_prepass = false;
+    bool enable_deferred_shading = false;
+    bool enable_atomic_rasterization = false;
     bool enable_rimlight = false;
 
+    // render the frame in bands of rows, see render()
+    bool enable_band_rendering = false;
+    int band_height;
+
     bool enable_bloom = false;
     float bloom_strength;
     float bloom_radius;
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef VERTEX_KERNEL_H
+#define VERTEX_KERNEL_H
+
+#include <cstddef>
+
+#include "geometry/mesh.hpp"
+#include "global.hpp"
+#include "shader/vertex_shader.hpp"
+#include "utils/transform.hpp"
+
+namespace vertex_kernel {
+// Number of vertices transformed at once, one vertex per SIMD lane.
+const size_t LANES = 8;
+
+// Number of consecutive vertices of a mesh in a unit of parallel work.
+const size_t BATCH_SIZE = 1024;
+static_assert(BATCH_SIZE % LANES == 0);
+}  // namespace vertex_kernel
+
+// Per-frame transform of the vertices of an object, fusing the model
+// transform, the transform of the vertex shader and the normal transform into
+// a single pass over the mesh.
+//
+// The vec3 attributes of vertex_kernel::LANES consecutive vertices are
+// transposed into one SIMD register per coordinate, so each matrix row is a
+// few multiply-adds for all lanes. The multiply-adds are in the order of the
+// Eigen products of Object::world_position(), Object::world_normal() and
+// VertexShader::shade(), fused where Eigen's pmadd fuses them with -mfma, so
+// the vertices are the same as transformed one by one in the Release build.
+// This depends on Eigen's evaluation order. Builds without AVX2 and FMA,
+// including the Debug build, take the unfused scalar path, and their
+// vertices may differ in the last bit from the Release build.
+class VertexKernel {
+   private:
+    // row-major matrices of the model transform, the normal transform and
+    // the world-to-screen transform of the vertex shader
+    float model[4][4];
+    float normal[3][3];
+    float screen[4][4];
+
+   public:
+    VertexKernel(const PositionTransform &model_transform,
+                 const NormalTransform &normal_transform,
+                 const VertexShader &vertex_shader);
+
+    // Write the world-space position and normal, and the screen-space
+    // position and w of the vertices [begin, end) of the mesh from their
+    // object-space attributes.
+    void transform(Mesh *mesh, const size_t begin, const size_t end) const;
+
+   private:
+    // Same as transform(), for the vertex i alone.
+    void transform_one(Mesh *mesh, const size_t i) const;
+};
+
+#endif
@@ -2,7 +2,8 @@
 #ifndef VERTEX_SHADER_H
 #define VERTEX_SHADER_H
 
-#include "geometry/vertex.hpp"
+#include <tuple>
+
 #include "global.hpp"
 #include "scene/camera.hpp"
 #include "utils/transform.hpp"
@@ -13,7 +14,9 @@ class VertexShader {
 
     VertexShader();
     VertexShader(const Camera &camera);
-    void shade(Vertex *vertex);
+
+    // Return the screen-space position and the w of the world-space position.
+    std::tuple<vec3, float> shade(const vec3 &pos) const;
 };
 
 #endif
\ No newline at end of file
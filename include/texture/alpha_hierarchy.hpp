@@ -0,0 +1,62 @@
+#pragma once
+#ifndef ALPHA_HIERARCHY_H
+#define ALPHA_HIERARCHY_H
+
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "global.hpp"
+#include "texture/texture.hpp"
+
+// Min/max mip hierarchy of an alpha texture, which classifies the alpha test
+// of all uv in a range without sampling the texels.
+class AlphaHierarchy {
+   public:
+    // Result of the alpha test, see Triangle::test_samples().
+    enum Coverage {
+        // all samples pass
+        OPAQUE,
+        // no sample passes
+        TRANSPARENT,
+        // the samples must be tested one by one
+        MIXED
+    };
+
+   private:
+    // minimum and maximum alpha of the texels covered by each node
+    class Level {
+       public:
+        size_t width;
+        size_t height;
+        std::vector<float> min_alpha;
+        std::vector<float> max_alpha;
+    };
+
+    size_t width;
+    size_t height;
+
+    // levels[0] holds the texels, and each level halves the previous one
+    std::vector<Level> levels;
+
+   public:
+    AlphaHierarchy(const Texture<float> &alpha_texture);
+
+    // Classify the alpha test of Texture::sample() at any uv in
+    // [min_uv, max_uv], with the repeat wrapping.
+    Coverage classify(const vec2 &min_uv, const vec2 &max_uv) const;
+
+   private:
+    // Return the ranges of texels [first, last] read by the bilinear sampling
+    // of the texture coordinates t in [min_t, max_t], where the texel
+    // coordinate is t * size - 0.5 (flipped if `flip`).
+    static std::vector<std::pair<size_t, size_t>> texel_ranges(
+        float min_t, float max_t, const size_t size, const bool flip);
+
+    // Return the minimum and maximum alpha of the texels
+    // [x0, x1] x [y0, y1].
+    std::tuple<float, float> min_max(const size_t x0, const size_t y0,
+                                     const size_t x1, const size_t y1) const;
+};
+
+#endif
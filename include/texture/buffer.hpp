@@ -2,29 +2,63 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
-#include <omp.h>
-
+#include <array>
 #include <memory>
 
 #include "effects/msaa.hpp"
+#include "rasterizer/coverage_kernel.hpp"
+#include "texture/compressed_msaa_texture.hpp"
 #include "texture/texture.hpp"
 
-template <typename T>
-using msaa_texture_t = Texture<std::array<T, msaa::MSAA_LEVEL>>;
+template <typename T, size_t MSAA_LEVEL>
+using msaa_texture_t = Texture<std::array<T, MSAA_LEVEL>>;
+
+template <size_t MSAA_LEVEL>
+using frame_buffer_t = CompressedMsaaTexture<vec3, MSAA_LEVEL>;
+template <size_t MSAA_LEVEL>
+using z_buffer_t = msaa_texture_t<float, MSAA_LEVEL>;
 
-using frame_buffer_t = msaa_texture_t<vec3>;
-using z_buffer_t = msaa_texture_t<float>;
+template <size_t MSAA_LEVEL>
+class HiZBuffer;
+class Triangle;
 
+template <size_t MSAA_LEVEL>
 class Buffer {
    public:
-    std::shared_ptr<Texture<omp_lock_t>> mutex = nullptr;
+    // relative position of the sampling points, see msaa::samples_coord_delta
+    std::array<vec2, MSAA_LEVEL> samples_coord_delta;
+    // offsets of the sampling points in the lanes of the coverage kernel
+    coverage::LaneOffsets<MSAA_LEVEL> lane_offsets;
 
-    std::shared_ptr<frame_buffer_t> frame_buffer = nullptr;
-    std::shared_ptr<z_buffer_t> z_buffer = nullptr;
+    std::shared_ptr<frame_buffer_t<MSAA_LEVEL>> frame_buffer = nullptr;
+    std::shared_ptr<z_buffer_t<MSAA_LEVEL>> z_buffer = nullptr;
+    std::shared_ptr<HiZBuffer<MSAA_LEVEL>> hi_z_buffer = nullptr;
 
-    std::shared_ptr<msaa_texture_t<vec3>> pos_buffer = nullptr;
-    std::shared_ptr<msaa_texture_t<vec3>> normal_buffer = nullptr;
+    std::shared_ptr<CompressedMsaaTexture<vec3, MSAA_LEVEL>> pos_buffer =
+        nullptr;
+    std::shared_ptr<CompressedMsaaTexture<vec3, MSAA_LEVEL>> normal_buffer =
+        nullptr;
     std::shared_ptr<Texture<bool>> full_covered = nullptr;
+
+    // samples at the background after the rasterization, see
+    // HiZBuffer::resolve()
+    std::shared_ptr<Texture<unsigned char>> background_flag = nullptr;
+
+    // samples already written after the depth prepass, so that only the first
+    // fragment at equal depth is kept, only used by the depth prepass
+    std::shared_ptr<Texture<unsigned char>> prepass_written_flag = nullptr;
+
+    // triangle visible at each sample, only used by deferred shading
+    std::shared_ptr<msaa_texture_t<Triangle *, MSAA_LEVEL>> visibility_buffer =
+        nullptr;
+
+    Buffer(const msaa::SamplePattern sample_pattern);
 };
 
-#endif
\ No newline at end of file
+template <size_t MSAA_LEVEL>
+Buffer<MSAA_LEVEL>::Buffer(const msaa::SamplePattern sample_pattern)
+    : samples_coord_delta(
+          msaa::samples_coord_delta<MSAA_LEVEL>(sample_pattern)),
+      lane_offsets(samples_coord_delta.data()) {}
+
+#endif
@@ -0,0 +1,118 @@
+#pragma once
+#ifndef COMPRESSED_MSAA_TEXTURE_H
+#define COMPRESSED_MSAA_TEXTURE_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "texture/texture.hpp"
+
+// MSAA texture storing one fragment per pixel plus a coverage mask of the
+// samples holding it. The other samples of the pixel, which only exist on the
+// edge pixels, are stored in an overflow slot.
+//
+// The overflow slots are allocated from a pool per region of
+// `region_size` x `region_size` pixels, so writes to different regions are
+// thread-safe, while writes to the same region must not run concurrently.
+template <typename T, size_t MSAA_LEVEL>
+class CompressedMsaaTexture {
+   public:
+    size_t width;
+    size_t height;
+
+   private:
+    static const uint32_t NO_SLOT = UINT32_MAX;
+    static const unsigned char FULL_MASK = (1u << MSAA_LEVEL) - 1;
+
+    size_t region_size;
+    size_t regions_x;
+
+    Texture<T> fragments;
+    // samples holding the fragment
+    Texture<unsigned char> masks;
+    // overflow slot in the pool of the region, or NO_SLOT
+    Texture<uint32_t> slots;
+
+    // overflow[region_id][slot], valid for the samples not in the mask
+    std::vector<std::vector<std::array<T, MSAA_LEVEL>>> overflow;
+
+   public:
+    CompressedMsaaTexture(const size_t width, const size_t height,
+                          const T init_val, const size_t region_size);
+
+    // Return if all samples of the pixel hold the same fragment.
+    inline bool is_uniform(const size_t x, const size_t y) const;
+
+    inline T sample(const size_t x, const size_t y, const size_t i) const;
+
+    // Write the value into the samples flagged in `covered_flag`.
+    inline void write(const size_t x, const size_t y,
+                      const unsigned char covered_flag, const T &value);
+
+   private:
+    inline size_t region_id(const size_t x, const size_t y) const;
+};
+
+template <typename T, size_t MSAA_LEVEL>
+CompressedMsaaTexture<T, MSAA_LEVEL>::CompressedMsaaTexture(
+    const size_t width, const size_t height, const T init_val,
+    const size_t region_size)
+    : width(width),
+      height(height),
+      region_size(region_size),
+      regions_x((width + region_size - 1) / region_size),
+      fragments(width, height, init_val),
+      masks(width, height, FULL_MASK),
+      slots(width, height, NO_SLOT),
+      overflow(regions_x * ((height + region_size - 1) / region_size)) {}
+
+template <typename T, size_t MSAA_LEVEL>
+inline bool CompressedMsaaTexture<T, MSAA_LEVEL>::is_uniform(
+    const size_t x, const size_t y) const {
+    return masks.at(x, y) == FULL_MASK;
+}
+
+template <typename T, size_t MSAA_LEVEL>
+inline T CompressedMsaaTexture<T, MSAA_LEVEL>::sample(const size_t x,
+                                                      const size_t y,
+                                                      const size_t i) const {
+    if (masks.at(x, y) & (1u << i)) return fragments.at(x, y);
+    return overflow[region_id(x, y)][slots.at(x, y)][i];
+}
+
+template <typename T, size_t MSAA_LEVEL>
+inline void CompressedMsaaTexture<T, MSAA_LEVEL>::write(
+    const size_t x, const size_t y, const unsigned char covered_flag,
+    const T &value) {
+    auto &mask = masks.at(x, y);
+
+    // the value covers all samples of the old fragment, so it becomes the
+    // fragment, and the overflow samples not covered stay valid
+    if ((mask & ~covered_flag) == 0) {
+        fragments.at(x, y) = value;
+        mask = covered_flag;
+        return;
+    }
+
+    // otherwise write the covered samples into the overflow slot, which is
+    // kept for reuse once allocated
+    auto &slot = slots.at(x, y);
+    auto &pool = overflow[region_id(x, y)];
+    if (slot == NO_SLOT) {
+        slot = pool.size();
+        pool.emplace_back();
+    }
+    for (size_t i = 0; i < MSAA_LEVEL; i++) {
+        if (covered_flag & (1u << i)) pool[slot][i] = value;
+    }
+    mask &= ~covered_flag;
+}
+
+template <typename T, size_t MSAA_LEVEL>
+inline size_t CompressedMsaaTexture<T, MSAA_LEVEL>::region_id(
+    const size_t x, const size_t y) const {
+    return y / region_size * regions_x + x / region_size;
+}
+
+#endif
@@ -9,7 +9,6 @@
 #include "texture/texture.hpp"
 
 namespace mipmap {
-const float LOD_SAMPLE_DELTA = 0.1;
 const int MIPMAP_LEVEL = 4;
 }  // namespace mipmap
 
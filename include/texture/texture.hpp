@@ -49,6 +49,10 @@ class Texture {
 
     T sample(const vec2 &uv) const;
     T sample_no_repeat(const vec2 &uv) const;
+
+    // Bilinearly sample at the point (x, y) of the image, where the center of
+    // the pixel (i, j) is at (i + 0.5, j + 0.5), clamped to the edge pixels.
+    T sample_no_repeat(float x, float y) const;
 };
 
 template <typename T>
@@ -241,9 +245,15 @@ void Texture<T>::read_alpha(const std::string &filename) {
 
 template <typename T>
 T Texture<T>::sample_no_repeat(const vec2 &uv) const {
-    // (x + 0.5, y + 0.5) = (u, v)
-    float x = uv.x() * static_cast<float>(width) - 0.5f;
-    float y = (1.f - uv.y()) * static_cast<float>(height) - 0.5f;
+    return sample_no_repeat(uv.x() * static_cast<float>(width),
+                            (1.f - uv.y()) * static_cast<float>(height));
+}
+
+template <typename T>
+T Texture<T>::sample_no_repeat(float x, float y) const {
+    // pixel centers at integer coordinates
+    x -= 0.5f;
+    y -= 0.5f;
 
     // truncate uv
     x = std::max(x, EPS);
@@ -2,6 +2,8 @@
 #ifndef FUNCTIONS_H
 #define FUNCTIONS_H
 
+#include <cstdint>
+
 #include "global.hpp"
 
 extern "C++" {
@@ -27,6 +29,21 @@ inline float luminance(const vec3 &color) {
 }
 
 inline float fract(const float &x) { return x - std::floor(x); }
+
+// Return the 30-bit Morton code interleaving the lowest 10 bits of x, y and z,
+// with x in the lowest bit.
+inline uint32_t morton_code(const uint32_t x, const uint32_t y,
+                            const uint32_t z) {
+    auto spread = [](uint32_t v) {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v << 8)) & 0x0300f00f;
+        v = (v | (v << 4)) & 0x030c30c3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef PNG_WRITER_H
+#define PNG_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "global.hpp"
+#include "texture/texture.hpp"
+
+// Writer of an RGB PNG image row by row, so that the image is encoded while
+// it is rendered, without keeping the whole image in memory. The image data is
+// stored without compression.
+class PngWriter {
+   private:
+    std::ofstream file;
+    size_t width;
+    size_t height;
+    size_t rows_written = 0;
+
+    // Adler-32 checksum of the image data written
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+
+   public:
+    PngWriter(const std::string &filename, const size_t width,
+              const size_t height);
+
+    // Append the rows [first_row, first_row + rows_num) of the texture to the
+    // image, converted as Texture::write_img().
+    void write_rows(const Texture<vec3> &texture, const size_t first_row,
+                    const size_t rows_num, const bool linear);
+
+   private:
+    void write_chunk(const char *type, const std::vector<uint8_t> &data);
+};
+
+#endif
@@ -13,6 +13,8 @@ class DirectionTransform {
     DirectionTransform();
 
     vec3 transform(const vec3 &pos) const;
+    const mat3 &get_matrix() const;
+
     void rotation(const vec3 &angle_deg);
 };
 
@@ -29,6 +31,7 @@ class PositionTransform {
     PositionTransform();
 
     vec4 transform(const vec4 &pos) const;
+    const mat4 &get_matrix() const;
 
     void translation(const vec3 &dist);
     void rotation(const vec3 &angle_deg);
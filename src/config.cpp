@@ -36,6 +36,11 @@ bool Config::load_scene(Scene *scene) const {
                                yaml_object["basepath"].as<std::string>()))
             return false;
 
+        if (yaml_object["optimize-mesh"] &&
+            yaml_object["optimize-mesh"].as<bool>()) {
+            object.optimize_mesh();
+        }
+
         // objects.material
         auto yaml_material = yaml_object["material"];
         if (yaml_material) {
@@ -71,10 +76,14 @@ bool Config::load_scene(Scene *scene) const {
                     yaml_material["bump-texname"].as<std::string>(), base_path,
                     true);
 
-            if (yaml_material["alpha-texname"])
+            if (yaml_material["alpha-texname"]) {
                 material->alpha_texture = object.load_texture_alpha(
                     yaml_material["alpha-texname"].as<std::string>(),
                     base_path);
+                material->alpha_hierarchy = object.load_alpha_hierarchy(
+                    yaml_material["alpha-texname"].as<std::string>(),
+                    base_path);
+            }
 
             if (yaml_material["roughness"])
                 material->roughness = yaml_material["roughness"].as<float>();
@@ -88,18 +97,16 @@ bool Config::load_scene(Scene *scene) const {
                     yaml_material["normal-texname"].as<std::string>(),
                     base_path, true);
 
-            object.materials.emplace_back(std::move(material));
-
-            for (auto &shape : object.shapes) {
-                for (auto &triangle : shape.triangles) {
-                    triangle.material = object.materials.back();
-                }
-            }
+            object.mesh->materials.emplace_back(std::move(material));
+            object.mesh->material_ids.assign(
+                object.mesh->triangles_size(),
+                object.mesh->materials.size() - 1);
+            object.classify_alpha();
         }
 
         if (yaml_object["shading-type"]) {
             object.shading_type = yaml_object["shading-type"].as<std::string>();
-            for (auto &material : object.materials) {
+            for (auto &material : object.mesh->materials) {
                 material->shading_type =
                     yaml_object["shading-type"].as<std::string>();
             }
@@ -132,6 +139,80 @@ bool Config::load_scene(Scene *scene) const {
             yaml_config["background-color"]);  // refers to Blender, no gamma
                                                // correction required
 
+    if (yaml_config["msaa"]) {
+        auto yaml_msaa = yaml_config["msaa"];
+        if (yaml_msaa["level"]) {
+            int msaa_level = yaml_msaa["level"].as<int>();
+            if (msaa_level == 1 || msaa_level == 2 || msaa_level == 4 ||
+                msaa_level == 8) {
+                scene->msaa_level = msaa_level;
+            } else {
+                std::cout << "[Warning] msaa level must be 1, 2, 4 or 8. "
+                             "Use the default level "
+                          << scene->msaa_level << "." << std::endl;
+            }
+        }
+        if (yaml_msaa["pattern"]) {
+            auto msaa_pattern = yaml_msaa["pattern"].as<std::string>();
+            if (msaa_pattern == "grid") {
+                scene->msaa_pattern = msaa::GRID;
+            } else if (msaa_pattern == "rotated") {
+                scene->msaa_pattern = msaa::ROTATED;
+            } else {
+                std::cout << "[Warning] Unknown msaa pattern: " << msaa_pattern
+                          << ". Use the grid pattern." << std::endl;
+            }
+        }
+    }
+
+    if (yaml_config["deterministic"]) {
+        scene->enable_deterministic =
+            yaml_config["deterministic"]["enable"].as<bool>();
+    }
+
+    if (yaml_config["occlusion-culling"]) {
+        scene->enable_occlusion_culling =
+            yaml_config["occlusion-culling"]["enable"].as<bool>();
+    }
+
+    if (yaml_config["z-prepass"]) {
+        scene->enable_z_prepass = yaml_config["z-prepass"]["enable"].as<bool>();
+    }
+
+    if (yaml_config["deferred-shading"]) {
+        scene->enable_deferred_shading =
+            yaml_config["deferred-shading"]["enable"].as<bool>();
+    }
+
+    if (yaml_config["atomic-rasterization"] &&
+        yaml_config["atomic-rasterization"]["enable"].as<bool>()) {
+        scene->enable_atomic_rasterization = true;
+        if (!scene->enable_deferred_shading) {
+            std::cout << "[Warning] atomic-rasterization requires "
+                         "deferred-shading. Disable atomic rasterization."
+                      << std::endl;
+            scene->enable_atomic_rasterization = false;
+        } else if (scene->enable_z_prepass) {
+            std::cout << "[Warning] z-prepass is redundant with "
+                         "atomic-rasterization. Disable z-prepass."
+                      << std::endl;
+            scene->enable_z_prepass = false;
+        }
+    }
+
+    if (yaml_config["band-rendering"] &&
+        yaml_config["band-rendering"]["enable"].as<bool>()) {
+        auto yaml_band = yaml_config["band-rendering"];
+        scene->enable_band_rendering = true;
+        scene->band_height = yaml_band["height"].as<int>();
+        if (scene->band_height < 1) {
+            std::cout << "[Warning] band-rendering height cannot be less "
+                         "than 1. Disable band rendering."
+                      << std::endl;
+            scene->enable_band_rendering = false;
+        }
+    }
+
     if (yaml_config["rimlight"]) {
         scene->enable_rimlight = yaml_config["rimlight"]["enable"].as<bool>();
     }
@@ -46,9 +46,10 @@ outline::OutlineVertexShader::OutlineVertexShader(const Camera &camera) {
     camera_pos = camera.pos;
 }
 
-void outline::OutlineVertexShader::shade(Vertex *vertex) {
-    vec3 view_vec = vertex->pos - camera_pos;
-    vertex->pos += vertex->normal * OUTLINE_WIDTH * std::tanh(view_vec.norm());
+vec3 outline::OutlineVertexShader::shade(const vec3 &pos,
+                                         const vec3 &smooth_normal) const {
+    vec3 view_vec = pos - camera_pos;
+    return pos + smooth_normal * OUTLINE_WIDTH * std::tanh(view_vec.norm());
 }
 
 vec3 outline::OutlineFragmentShader::shade(const vec3 &pos, const vec3 &normal,
@@ -0,0 +1,125 @@
+#include "geometry/cluster.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "shader/vertex_shader.hpp"
+
+/////////////
+// Frustum //
+/////////////
+
+Frustum::Frustum(const Camera &camera) : camera_pos(camera.pos) {
+    // a vertex is at the screen-space position (r0, r1, r2) / r3 of the rows
+    // of the vertex shader, so each bound of Triangle::is_culled_view() is a
+    // plane when r3 > 0, and the vertices with r3 < EPS are culled anyway
+    auto vertex_shader = VertexShader(camera);
+    const mat4 &m = vertex_shader.position_transform.get_matrix();
+    vec4 r0 = m.row(0);
+    vec4 r1 = m.row(1);
+    vec4 r2 = m.row(2);
+    vec4 r3 = m.row(3);
+    float offset_y = camera.offset_y;
+
+    const vec4 planes[6] = {r0 + EPS * r3,
+                            (camera.width + EPS) * r3 - r0,
+                            r1 - (offset_y - EPS) * r3,
+                            (offset_y + camera.height + EPS) * r3 - r1,
+                            r2 + EPS * r3,
+                            (1.f + EPS) * r3 - r2};
+    for (size_t k = 0; k < 6; k++) {
+        vec3 normal = planes[k].head<3>();
+        float norm = normal.norm();
+        normals[k] = normal / norm;
+        offsets[k] = planes[k].w() / norm;
+    }
+}
+
+bool Frustum::is_outside(const vec3 &center, const float radius) const {
+    float margin = cluster::DISTANCE_MARGIN * (center - camera_pos).norm();
+    for (size_t k = 0; k < 6; k++) {
+        if (normals[k].dot(center) + offsets[k] < -radius - margin) {
+            return true;
+        }
+    }
+    return false;
+}
+
+///////////////////
+// ClusterBounds //
+///////////////////
+
+ClusterBounds::ClusterBounds() {}
+
+ClusterBounds::ClusterBounds(const Triangle *first, const size_t size) {
+    if (size == 0) return;
+    const Mesh &mesh = *first->mesh;
+    auto vertex = [&](const size_t t, const size_t i) {
+        return mesh.indices[3 * first[t].id + i];
+    };
+
+    // sphere around the center of the bounding box
+    vec3 min_pos = mesh.positions[vertex(0, 0)];
+    vec3 max_pos = min_pos;
+    for (size_t t = 0; t < size; t++) {
+        for (size_t i = 0; i < 3; i++) {
+            const vec3 &pos = mesh.positions[vertex(t, i)];
+            min_pos = min_pos.cwiseMin(pos);
+            max_pos = max_pos.cwiseMax(pos);
+        }
+    }
+    center = (min_pos + max_pos) / 2.f;
+    for (size_t t = 0; t < size; t++) {
+        for (size_t i = 0; i < 3; i++) {
+            radius = std::max(radius,
+                              (mesh.positions[vertex(t, i)] - center).norm());
+        }
+    }
+
+    // cone around the mean direction of the normals
+    has_cone = true;
+    vec3 normal_sum = vec3(0, 0, 0);
+    for (size_t t = 0; t < size && has_cone; t++) {
+        has_cone = first[t].has_normals;
+        for (size_t i = 0; i < 3 && has_cone; i++) {
+            const vec3 &normal = mesh.normals[vertex(t, i)];
+            has_cone = normal.squaredNorm() > 0;
+            if (has_cone) normal_sum += normal.normalized();
+        }
+    }
+    if (!has_cone || normal_sum.squaredNorm() == 0) {
+        has_cone = false;
+        return;
+    }
+    cone_axis = normal_sum.normalized();
+    for (size_t t = 0; t < size; t++) {
+        for (size_t i = 0; i < 3; i++) {
+            vec3 normal = mesh.normals[vertex(t, i)].normalized();
+            cone_angle = std::max(
+                cone_angle,
+                std::acos(std::clamp(cone_axis.dot(normal), -1.f, 1.f)));
+        }
+    }
+    // no vertex can face the culled side from all directions
+    has_cone = cone_angle < M_PI / 2;
+}
+
+bool ClusterBounds::is_culled(const Frustum &frustum, const Camera &camera,
+                              Triangle::CullMethod cull_method) const {
+    if (frustum.is_outside(center, radius)) return true;
+    if (!has_cone || cull_method == Triangle::NO_CULL) return false;
+
+    // Triangle::facing() of a vertex is the culled side if the angle between
+    // its normal, negated for CULL_FRONT, and the direction to the camera
+    // exceeds acos(-EPS). The normals are within cone_angle of the axis, and
+    // the directions from the sphere within asin(radius / distance) of the
+    // direction from the center.
+    vec3 dir = camera.pos - center;
+    float distance = dir.norm();
+    if (distance <= radius) return false;
+
+    vec3 axis = cull_method == Triangle::CULL_BACK ? cone_axis : -cone_axis;
+    float angle = std::acos(std::clamp(axis.dot(dir) / distance, -1.f, 1.f));
+    return angle - cone_angle - std::asin(radius / distance) >
+           std::acos(-EPS) + cluster::ANGLE_MARGIN;
+}
@@ -0,0 +1,80 @@
+#include "geometry/mesh.hpp"
+
+namespace {
+
+// Return the elements of `values` in the order of `order`.
+template <typename T>
+std::vector<T> permute(const std::vector<T> &values,
+                       const std::vector<uint32_t> &order) {
+    std::vector<T> result;
+    result.reserve(values.size());
+    for (uint32_t i : order) {
+        result.push_back(values[i]);
+    }
+    return result;
+}
+
+}  // namespace
+
+size_t Mesh::vertices_size() const { return positions.size(); }
+
+size_t Mesh::triangles_size() const { return material_ids.size(); }
+
+uint32_t Mesh::add_vertex(const vec3 &position, const vec3 &normal,
+                          const vec2 &texcoord, const vec3 &smooth_normal) {
+    positions.push_back(position);
+    normals.push_back(normal);
+    texcoords.push_back(texcoord);
+    smooth_normals.push_back(smooth_normal);
+    world_positions.push_back(position);
+    world_normals.push_back(normal);
+    screen_positions.emplace_back(0, 0, 0);
+    ws.push_back(0);
+    return positions.size() - 1;
+}
+
+uint32_t Mesh::add_triangle(const uint32_t v0, const uint32_t v1,
+                            const uint32_t v2, const uint32_t material_id) {
+    indices.push_back(v0);
+    indices.push_back(v1);
+    indices.push_back(v2);
+    material_ids.push_back(material_id);
+    return material_ids.size() - 1;
+}
+
+void Mesh::reorder(const std::vector<uint32_t> &order) {
+    std::vector<uint32_t> reordered_indices;
+    reordered_indices.reserve(indices.size());
+    for (uint32_t t : order) {
+        for (size_t i = 0; i < 3; i++) {
+            reordered_indices.push_back(indices[3 * t + i]);
+        }
+    }
+    indices = std::move(reordered_indices);
+    material_ids = permute(material_ids, order);
+
+    // new index of each vertex, and old index of each new vertex
+    const uint32_t NO_VERTEX = UINT32_MAX;
+    std::vector<uint32_t> remap(vertices_size(), NO_VERTEX);
+    std::vector<uint32_t> vertex_order;
+    vertex_order.reserve(vertices_size());
+    for (uint32_t &v : indices) {
+        if (remap[v] == NO_VERTEX) {
+            remap[v] = vertex_order.size();
+            vertex_order.push_back(v);
+        }
+        v = remap[v];
+    }
+    for (uint32_t v = 0; v < vertices_size(); v++) {
+        if (remap[v] == NO_VERTEX) vertex_order.push_back(v);
+    }
+
+    positions = permute(positions, vertex_order);
+    normals = permute(normals, vertex_order);
+    texcoords = permute(texcoords, vertex_order);
+    smooth_normals = permute(smooth_normals, vertex_order);
+    world_positions = permute(world_positions, vertex_order);
+    world_normals = permute(world_normals, vertex_order);
+    screen_positions = permute(screen_positions, vertex_order);
+    ws = permute(ws, vertex_order);
+}
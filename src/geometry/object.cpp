@@ -1,11 +1,15 @@
 #include "geometry/object.hpp"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <numeric>
+#include <vector>
 
+#include "geometry/mesh.hpp"
 #include "geometry/shape.hpp"
 #include "geometry/triangle.hpp"
-#include "geometry/vertex.hpp"
 #include "global.hpp"
 #include "scene/material.hpp"
 #include "utils/functions.hpp"
@@ -27,20 +31,14 @@ Object::Object(const vec3& pos, const vec3& rotation, const vec3& scale) {
     normal_transform.rotation(rotation);
 }
 
-void Object::do_model_transform() {
-    // vertex
-    for (auto& vertex : vertices) {
-        vec4 pos = model_transform.transform(
-            vec4(vertex->pos.x(), vertex->pos.y(), vertex->pos.z(), 1));
-        vertex->pos = vec3(pos.x(), pos.y(), pos.z()) / pos.w();
-        vertex->normal =
-            normal_transform.transform(vertex->normal).normalized();
-    }
+vec3 Object::world_position(const vec3& pos) const {
+    vec4 world_pos =
+        model_transform.transform(vec4(pos.x(), pos.y(), pos.z(), 1));
+    return vec3(world_pos.x(), world_pos.y(), world_pos.z()) / world_pos.w();
+}
 
-    // normal
-    for (auto& normal : normals) {
-        *normal = normal_transform.transform(*normal).normalized();
-    }
+vec3 Object::world_normal(const vec3& normal) const {
+    return normal_transform.transform(normal).normalized();
 }
 
 bool Object::load_model(const std::string& filename,
@@ -68,26 +66,6 @@ bool Object::load_model(const std::string& filename,
     std::cout << "Shapes count: " << t_shapes.size() << std::endl;
     std::cout << "Materials cout: " << t_materials.size() << std::endl;
 
-    vertices.reserve(t_attrib.vertices.size() / 3);
-    for (size_t i = 0; i < t_attrib.vertices.size(); i += 3) {
-        vertices.emplace_back(std::make_shared<Vertex>(
-            vec3(t_attrib.vertices[i], t_attrib.vertices[i + 1],
-                 t_attrib.vertices[i + 2])));
-    }
-
-    normals.reserve(t_attrib.normals.size() / 3);
-    for (size_t i = 0; i < t_attrib.normals.size(); i += 3) {
-        normals.emplace_back(std::make_shared<vec3>(t_attrib.normals[i],
-                                                    t_attrib.normals[i + 1],
-                                                    t_attrib.normals[i + 2]));
-    }
-
-    texcoords.reserve(t_attrib.texcoords.size() / 2);
-    for (size_t i = 0; i < t_attrib.texcoords.size(); i += 2) {
-        texcoords.emplace_back(std::make_shared<vec2>(
-            t_attrib.texcoords[i], t_attrib.texcoords[i + 1]));
-    }
-
     for (auto& t_material : t_materials) {
         auto material = std::make_shared<Material>();
 
@@ -137,6 +115,8 @@ bool Object::load_model(const std::string& filename,
         if (!t_material.alpha_texname.empty()) {
             material->alpha_texture =
                 load_texture_alpha(t_material.alpha_texname, basepath);
+            material->alpha_hierarchy =
+                load_alpha_hierarchy(t_material.alpha_texname, basepath);
         }
 
         // material.specular_highlight_texname =
@@ -175,65 +155,221 @@ bool Object::load_model(const std::string& filename,
                 load_mipmap<vec3>(t_material.normal_texname, basepath, true);
         }
 
-        materials.emplace_back(std::move(material));
+        mesh->materials.emplace_back(std::move(material));
     }
 
+    auto position = [&](const int i) {
+        return vec3(t_attrib.vertices[3 * i], t_attrib.vertices[3 * i + 1],
+                    t_attrib.vertices[3 * i + 2]);
+    };
+    auto normal = [&](const int i) {
+        if (i == -1) return vec3(0, 0, 0);
+        return vec3(t_attrib.normals[3 * i], t_attrib.normals[3 * i + 1],
+                    t_attrib.normals[3 * i + 2]);
+    };
+    auto texcoord = [&](const int i) {
+        if (i == -1) return vec2(0, 0);
+        return vec2(t_attrib.texcoords[2 * i], t_attrib.texcoords[2 * i + 1]);
+    };
+
+    // sum of the normals of the faces at each position, see
+    // Mesh::smooth_normals
+    size_t positions_num = t_attrib.vertices.size() / 3;
+    std::vector<vec3> smooth_normals(positions_num, vec3(0, 0, 0));
+    for (auto& t_shape : t_shapes) {
+        for (auto& idx : t_shape.mesh.indices) {
+            if (idx.normal_index != -1)
+                smooth_normals[idx.vertex_index] += normal(idx.normal_index);
+        }
+    }
+    for (auto& smooth_normal : smooth_normals) {
+        smooth_normal = smooth_normal.normalized();
+    }
+
+    // The mesh vertices at each position are chained by `next_vertex`, and
+    // `vertex_sources` keeps the attribute indices each vertex is made of.
+    const uint32_t NO_VERTEX = UINT32_MAX;
+    std::vector<uint32_t> first_vertex(positions_num, NO_VERTEX);
+    std::vector<uint32_t> next_vertex;
+    std::vector<tinyobj::index_t> vertex_sources;
+
+    // Return the mesh vertex of the attribute indices, appended on the first
+    // use.
+    auto vertex_of = [&](const tinyobj::index_t& idx) {
+        uint32_t* link = &first_vertex[idx.vertex_index];
+        while (*link != NO_VERTEX) {
+            const tinyobj::index_t& source = vertex_sources[*link];
+            if (source.normal_index == idx.normal_index &&
+                source.texcoord_index == idx.texcoord_index) {
+                return *link;
+            }
+            link = &next_vertex[*link];
+        }
+
+        *link = mesh->add_vertex(
+            position(idx.vertex_index), normal(idx.normal_index),
+            texcoord(idx.texcoord_index), smooth_normals[idx.vertex_index]);
+        next_vertex.push_back(NO_VERTEX);
+        vertex_sources.push_back(idx);
+        return *link;
+    };
+
     size_t faces_count = 0;
 
     // For each shape
     for (auto& t_shape : t_shapes) {
         auto shape = Shape();
-
-        size_t index_offset = 0;
+        shape.first = triangles.size();
+        shape.size = t_shape.mesh.num_face_vertices.size();
 
         faces_count += t_shape.mesh.num_face_vertices.size();
 
-        // For each face
-        shape.triangles.reserve(t_shape.mesh.num_face_vertices.size());
+        // For each face, which is a triangle as the faces are triangulated
+        // when loaded
         for (size_t f = 0; f < t_shape.mesh.num_face_vertices.size(); f++) {
-            size_t fnum = t_shape.mesh.num_face_vertices[f];
+            uint32_t face_vertices[3];
+            bool has_normals = true;
+            bool has_texcoords = true;
 
-            auto triangle = Triangle();
-
-            triangle.vertices.reserve(3);
             // For each vertex in the face
-            for (size_t v = 0; v < fnum; v++) {
-                tinyobj::index_t idx = t_shape.mesh.indices[index_offset + v];
-                triangle.vertices.emplace_back(vertices[idx.vertex_index]);
-                if (idx.normal_index != -1) {
-                    triangle.normals.emplace_back(normals[idx.normal_index]);
-                    vertices[idx.vertex_index]->normal +=
-                        *normals[idx.normal_index];
-                }
-                if (idx.texcoord_index != -1)
-                    triangle.texcoords.emplace_back(
-                        texcoords[idx.texcoord_index]);
+            for (size_t v = 0; v < 3; v++) {
+                tinyobj::index_t idx = t_shape.mesh.indices[3 * f + v];
+                face_vertices[v] = vertex_of(idx);
+                has_normals &= idx.normal_index != -1;
+                has_texcoords &= idx.texcoord_index != -1;
             }
 
-            if (t_shape.mesh.material_ids[f] != -1)
-                triangle.material = materials[t_shape.mesh.material_ids[f]];
-
-            // printf("  face[%ld].smoothing_group_id = %d\n",
-            //        static_cast<long>(f),
-            //        t_shape.mesh.smoothing_group_ids[f]);
-
-            shape.triangles.emplace_back(std::move(triangle));
+            uint32_t material_id = t_shape.mesh.material_ids[f] == -1
+                                       ? Mesh::NO_MATERIAL
+                                       : t_shape.mesh.material_ids[f];
 
-            index_offset += fnum;
+            uint32_t id =
+                mesh->add_triangle(face_vertices[0], face_vertices[1],
+                                   face_vertices[2], material_id);
+            triangles.emplace_back(mesh.get(), id, has_normals,
+                                   has_texcoords);
         }
 
         shapes.emplace_back(std::move(shape));
     }
 
-    for (auto& vertex : vertices) {
-        vertex->normal = vertex->normal.normalized();
-    }
+    classify_alpha();
+    build_clusters();
 
     std::cout << "Faces count: " << faces_count << std::endl;
+    std::cout << "Mesh vertices count: " << mesh->vertices_size()
+              << std::endl;
+    std::cout << "Clusters count: " << clusters.size() << std::endl;
 
     return true;
 }
 
+void Object::optimize_mesh() {
+    if (triangles.empty()) return;
+
+    // cells of the Morton curve per axis of the bounding box
+    const float MORTON_CELLS = 1 << 10;
+
+    vec3 min_pos = mesh->positions[0];
+    vec3 max_pos = mesh->positions[0];
+    for (auto& pos : mesh->positions) {
+        min_pos = min_pos.cwiseMin(pos);
+        max_pos = max_pos.cwiseMax(pos);
+    }
+    vec3 extent = max_pos - min_pos;
+    vec3 cell_scale;
+    for (size_t k = 0; k < 3; k++) {
+        cell_scale[k] = extent[k] > 0 ? (MORTON_CELLS - 1) / extent[k] : 0;
+    }
+
+    std::vector<uint32_t> codes(triangles.size());
+    for (size_t t = 0; t < triangles.size(); t++) {
+        const uint32_t* v = &mesh->indices[3 * t];
+        vec3 centroid = (mesh->positions[v[0]] + mesh->positions[v[1]] +
+                         mesh->positions[v[2]]) /
+                        3.f;
+        vec3 cell = (centroid - min_pos).cwiseProduct(cell_scale);
+        codes[t] = morton_code(std::lround(cell.x()), std::lround(cell.y()),
+                               std::lround(cell.z()));
+    }
+
+    // sorted within each shape, and stable so that the triangles in the same
+    // cell keep their order
+    std::vector<uint32_t> order(triangles.size());
+    std::iota(order.begin(), order.end(), 0);
+    for (auto& shape : shapes) {
+        auto first = order.begin() + shape.first;
+        std::stable_sort(first, first + shape.size,
+                         [&](const uint32_t a, const uint32_t b) {
+                             return codes[a] < codes[b];
+                         });
+    }
+
+    mesh->reorder(order);
+
+    std::vector<Triangle> reordered_triangles;
+    reordered_triangles.reserve(triangles.size());
+    for (size_t t = 0; t < triangles.size(); t++) {
+        reordered_triangles.push_back(triangles[order[t]]);
+        reordered_triangles.back().id = t;
+    }
+    triangles = std::move(reordered_triangles);
+    build_clusters();
+}
+
+void Object::build_clusters() {
+    clusters.clear();
+    for (auto& shape : shapes) {
+        size_t clusters_num = (shape.size + cluster::MAX_TRIANGLES - 1) /
+                              cluster::MAX_TRIANGLES;
+        for (size_t k = 0; k < clusters_num; k++) {
+            // split evenly, so the sizes differ by at most one
+            size_t begin = shape.size * k / clusters_num;
+            size_t end = shape.size * (k + 1) / clusters_num;
+
+            Cluster cluster;
+            cluster.first = shape.first + begin;
+            cluster.size = end - begin;
+            cluster.bounds =
+                ClusterBounds(&triangles[cluster.first], cluster.size);
+            clusters.push_back(cluster);
+        }
+    }
+}
+
+ClusterBounds Object::world_bounds(const ClusterBounds& bounds) const {
+    ClusterBounds result = bounds;
+    result.center = world_position(bounds.center);
+
+    // the model transform is a scale followed by a rotation and a
+    // translation, see Object(), so the largest scale of a direction is the
+    // largest norm of a column
+    mat3 linear = model_transform.get_matrix().topLeftCorner<3, 3>();
+    result.radius = bounds.radius * linear.colwise().norm().maxCoeff();
+
+    // the angles between the normals are kept only by a rotation with a
+    // uniform scale
+    if (bounds.has_cone) {
+        const mat3& normal_matrix = normal_transform.get_matrix();
+        mat3 gram = normal_matrix.transpose() * normal_matrix;
+        float scale = gram.trace() / 3.f;
+        if ((gram - scale * mat3::Identity()).cwiseAbs().maxCoeff() >
+            EPS * scale) {
+            result.has_cone = false;
+        } else {
+            result.cone_axis = normal_transform.transform(bounds.cone_axis)
+                                   .normalized();
+        }
+    }
+    return result;
+}
+
+void Object::classify_alpha() {
+    for (auto& triangle : triangles) {
+        triangle.classify_alpha();
+    }
+}
+
 std::shared_ptr<Texture<float>> Object::load_texture_alpha(
     const std::string& texname, const std::filesystem::path& base_path) {
     std::shared_ptr<Texture<float>> tex_ptr = nullptr;
@@ -263,4 +399,20 @@ std::shared_ptr<Mipmap<float>> Object::load_mipmap_alpha(
         mipmap_ptr = std::make_shared<Mipmap<float>>(texture);
     }
     return mipmap_ptr;
-}
\ No newline at end of file
+}
+
+std::shared_ptr<AlphaHierarchy> Object::load_alpha_hierarchy(
+    const std::string& texname, const std::filesystem::path& base_path) {
+    std::shared_ptr<AlphaHierarchy> hierarchy_ptr = nullptr;
+
+    if (alpha_hierarchy_map.find(texname) !=
+        alpha_hierarchy_map.end()) {  // loaded hierarchy found
+        hierarchy_ptr = alpha_hierarchy_map.at(texname);
+    } else {  // not found
+        std::shared_ptr<Texture<float>> texture =
+            load_texture_alpha(texname, base_path);
+        hierarchy_ptr = std::make_shared<AlphaHierarchy>(*texture);
+        alpha_hierarchy_map.emplace(texname, hierarchy_ptr);
+    }
+    return hierarchy_ptr;
+}
@@ -10,6 +10,13 @@
 #include "global.hpp"
 #include "texture/mipmap.hpp"
 
+Triangle::Triangle(const Mesh *mesh, const uint32_t id, const bool has_normals,
+                   const bool has_texcoords)
+    : mesh(mesh),
+      id(id),
+      has_normals(has_normals),
+      has_texcoords(has_texcoords) {}
+
 float Triangle::cross2d(const vec2 &v1, const vec2 &v2) {
     return v1.x() * v2.y() - v2.x() * v1.y();
 }
@@ -21,66 +28,33 @@ float Triangle::truncate_x_ss(float x, const Camera &camera) {
 }
 
 float Triangle::truncate_y_ss(float y, const Camera &camera) {
-    y = std::min(y, static_cast<float>(camera.height));
-    y = std::max(y, 0.f);
+    y = std::min(y, static_cast<float>(camera.offset_y + camera.height));
+    y = std::max(y, static_cast<float>(camera.offset_y));
     return y;
 }
 
+int Triangle::facing(const vec3 &normal, const vec3 &pos,
+                     const Camera &camera) {
+    // compare the cosine against EPS without normalizing the direction:
+    // cos = dot / |dir|, so |cos| <= EPS iff dot^2 <= EPS^2 * |dir|^2
+    vec3 dir = camera.pos - pos;
+    float dot = normal.dot(dir);
+    if (dot * dot <= EPS * EPS * dir.squaredNorm()) return 0;
+    return dot > 0 ? 1 : -1;
+}
+
 bool Triangle::is_culled_normal(const Camera &camera,
                                 CullMethod cull_method) const {
-    if (normals.empty()) {
-        vec3 normal = this->normal();
-        switch (cull_method) {
-            case CULL_BACK: {
-                for (size_t i = 0; i < 3; i++) {
-                    if (normal.dot(
-                            (camera.pos - vertices[i]->pos).normalized()) >
-                        -EPS) {
-                        return false;
-                    }
-                }
-                return true;
-            }
-            case CULL_FRONT: {
-                for (size_t i = 0; i < 3; i++) {
-                    if (normal.dot(
-                            (camera.pos - vertices[i]->pos).normalized()) <
-                        EPS) {
-                        return false;
-                    }
-                }
-                return true;
-            }
-            case NO_CULL:
-                return false;
-        }
-    } else {
-        switch (cull_method) {
-            case CULL_BACK: {
-                for (size_t i = 0; i < 3; i++) {
-                    if (normals[i]->dot(
-                            (camera.pos - vertices[i]->pos).normalized()) >
-                        -EPS) {
-                        return false;
-                    }
-                }
-                return true;
-            }
-            case CULL_FRONT: {
-                for (size_t i = 0; i < 3; i++) {
-                    if (normals[i]->dot(
-                            (camera.pos - vertices[i]->pos).normalized()) <
-                        EPS) {
-                        return false;
-                    }
-                }
-                return true;
-            }
-            case NO_CULL:
-                return false;
+    if (cull_method == NO_CULL) return false;
+
+    // culled if the normals at all vertices face the culled side
+    int culled_facing = cull_method == CULL_BACK ? -1 : 1;
+    for (size_t i = 0; i < 3; i++) {
+        if (facing(vertex_normal(i), pos(i), camera) != culled_facing) {
+            return false;
         }
     }
-    return false;
+    return true;
 }
 
 bool Triangle::is_culled_normal(const vec3 &normal, const vec3 &pos,
@@ -88,9 +62,9 @@ bool Triangle::is_culled_normal(const vec3 &normal, const vec3 &pos,
                                 CullMethod cull_method) const {
     switch (cull_method) {
         case CULL_BACK:
-            return normal.dot((camera.pos - pos).normalized()) < -EPS;
+            return facing(normal, pos, camera) < 0;
         case CULL_FRONT:
-            return normal.dot((camera.pos - pos).normalized()) > EPS;
+            return facing(normal, pos, camera) > 0;
         case NO_CULL:
             return false;
     }
@@ -98,50 +72,279 @@ bool Triangle::is_culled_normal(const vec3 &normal, const vec3 &pos,
 }
 
 bool Triangle::is_culled_view(const Camera &camera) const {
-    // cull boundary
-    const float L1[] = {-EPS, -EPS, -EPS};
-    const float R1[] = {camera.width + EPS, camera.height + EPS, 1.f + EPS};
+    // cull boundary, the rows of the frame rendered by the camera
+    const float L1[] = {-EPS, camera.offset_y - EPS, -EPS};
+    const float R1[] = {camera.width + EPS,
+                        camera.offset_y + camera.height + EPS, 1.f + EPS};
 
     // for each dimension
     for (size_t i = 0; i < 3; i++) {
         // culled if all vertices are outside the view (in the same side)
 
         // test < 0
-        if (vertices[0]->screen_pos[i] < L1[i] &&
-            vertices[1]->screen_pos[i] < L1[i] &&
-            vertices[2]->screen_pos[i] < L1[i]) {
+        if (screen_pos(0)[i] < L1[i] && screen_pos(1)[i] < L1[i] &&
+            screen_pos(2)[i] < L1[i]) {
             return true;
         }
 
         // test > 1
-        if (vertices[0]->screen_pos[i] > R1[i] &&
-            vertices[1]->screen_pos[i] > R1[i] &&
-            vertices[2]->screen_pos[i] > R1[i]) {
+        if (screen_pos(0)[i] > R1[i] && screen_pos(1)[i] > R1[i] &&
+            screen_pos(2)[i] > R1[i]) {
+            return true;
+        }
+
+        if (w(0) < EPS || w(1) < EPS || w(2) < EPS) {
             return true;
         }
+    }
 
-        if (vertices[0]->w < EPS || vertices[1]->w < EPS ||
-            vertices[2]->w < EPS) {
+    // cull the triangles beyond the guard band, whose fixed-point edge
+    // functions may overflow
+    for (size_t i = 0; i < 3; i++) {
+        if (std::fabs(screen_pos(i).x()) > coverage::GUARD_BAND ||
+            std::fabs(screen_pos(i).y()) > coverage::GUARD_BAND) {
             return true;
         }
     }
     return false;
 }
 
-bool Triangle::is_inside_ss(const vec3 &w) const {
-    return -EPS < w.x() && -EPS < w.y() && -EPS < w.z();
+void Triangle::classify_alpha() {
+    Material *material = this->material();
+    if (material == nullptr || material->alpha_texture == nullptr ||
+        !has_texcoords) {
+        alpha_coverage = AlphaHierarchy::OPAQUE;
+        return;
+    }
+    if (material->alpha_hierarchy == nullptr) {
+        alpha_coverage = AlphaHierarchy::MIXED;
+        return;
+    }
+
+    // the interpolated uv is always inside the triangle of the texcoords
+    vec2 min_uv = texcoord(0).cwiseMin(texcoord(1)).cwiseMin(texcoord(2));
+    vec2 max_uv = texcoord(0).cwiseMax(texcoord(1)).cwiseMax(texcoord(2));
+    alpha_coverage = material->alpha_hierarchy->classify(min_uv, max_uv);
+}
+
+bool Triangle::is_culled(const Camera &camera, CullMethod cull_method) const {
+    if (alpha_coverage == AlphaHierarchy::TRANSPARENT) return true;
+    if (is_culled_view(camera)) return true;
+
+    // signed area in the screen space, whose sign is the facing of the
+    // triangle plane
+    const vec3 &p1 = screen_pos(0);
+    const vec3 &p2 = screen_pos(1);
+    const vec3 &p3 = screen_pos(2);
+    float area = (p2.x() - p1.x()) * (p3.y() - p1.y()) -
+                 (p2.y() - p1.y()) * (p3.x() - p1.x());
+    if (area == 0) return true;
+
+    if (has_normals) return is_culled_normal(camera, cull_method);
+
+    switch (cull_method) {
+        case CULL_BACK:
+            return area > 0;
+        case CULL_FRONT:
+            return area < 0;
+        case NO_CULL:
+            return false;
+    }
+    return false;
+}
+
+bool Triangle::setup(const Camera &camera, SetupBuffer *setups) {
+    auto [min_x, min_y, max_x, max_y] = bounding_box_ss(camera);
+    if (min_x >= max_x || min_y >= max_y) return false;
+
+    int64_t edge[3], edge_dx[3], edge_dy[3];
+    if (!calc_edges(min_x, min_y + camera.offset_y, edge, edge_dx, edge_dy)) {
+        return false;
+    }
+
+    // tangent space conversion
+    if (has_texcoords && material()->normal_texture != nullptr) {
+        vec3 e1 = pos(0) - pos(1);
+        vec3 e2 = pos(0) - pos(2);
+
+        vec2 delta_uv1 = texcoord(0) - texcoord(1);
+        vec2 delta_uv2 = texcoord(0) - texcoord(2);
+
+        float f =
+            (delta_uv1.x() * delta_uv2.y() - delta_uv2.x() * delta_uv1.y());
+
+        tbn_u = ((delta_uv2.y() * e1 - delta_uv1.y() * e2) / f).normalized();
+    }
+
+    // derivatives of the screen-space barycentric coordinate, see
+    // barycoord_ss()
+    auto v1 = vec2(screen_pos(0).x(), screen_pos(0).y());
+    auto v2 = vec2(screen_pos(1).x(), screen_pos(1).y());
+    auto v3 = vec2(screen_pos(2).x(), screen_pos(2).y());
+
+    float dx1 = v2.x() - v3.x();
+    float dy1 = v2.y() - v3.y();
+    float det1 = v2.x() * v3.y() - v3.x() * v2.y();
+    float denom1 = dy1 * v1.x() - dx1 * v1.y() + det1;
+
+    float dx2 = v3.x() - v1.x();
+    float dy2 = v3.y() - v1.y();
+    float det2 = v3.x() * v1.y() - v1.x() * v3.y();
+    float denom2 = dy2 * v2.x() - dx2 * v2.y() + det2;
+
+    float w1_dx = dy1 / denom1;
+    float w1_dy = -dx1 / denom1;
+    float w2_dx = dy2 / denom2;
+    float w2_dy = -dx2 / denom2;
+    barycoord_dx = vec3(w1_dx, w2_dx, -w1_dx - w2_dx);
+    barycoord_dy = vec3(w1_dy, w2_dy, -w1_dy - w2_dy);
+
+    // derivatives of 1 / w and uv / w, which are linear in the screen space
+    if (has_texcoords) {
+        vec3 inv_w = vec3(1.f / w(0), 1.f / w(1), 1.f / w(2));
+        inv_w_dx = barycoord_dx.dot(inv_w);
+        inv_w_dy = barycoord_dy.dot(inv_w);
+
+        auto texcoord_over_w = std::make_tuple<vec2, vec2, vec2>(
+            texcoord(0) * inv_w.x(), texcoord(1) * inv_w.y(),
+            texcoord(2) * inv_w.z());
+        uv_over_w_dx = interpolate(
+            texcoord_over_w, std::make_tuple(barycoord_dx.x(), barycoord_dx.y(),
+                                             barycoord_dx.z()));
+        uv_over_w_dy = interpolate(
+            texcoord_over_w, std::make_tuple(barycoord_dy.x(), barycoord_dy.y(),
+                                             barycoord_dy.z()));
+    }
+
+    // setup record for the traversal
+    size_t index = setups->append(this);
+    setups->min_x[index] = min_x;
+    setups->min_y[index] = min_y;
+    setups->max_x[index] = max_x;
+    setups->max_y[index] = max_y;
+
+    // the top of the triangle clamped to the frame, which is the same for all
+    // bands, so that they step the planes from the same pixel center
+    int plane_frame_y = std::clamp<int>(
+        std::floor(std::min(
+            {screen_pos(0).y(), screen_pos(1).y(), screen_pos(2).y()})),
+        0, camera.frame_height);
+    setups->plane_y[index] = plane_frame_y - camera.offset_y;
+
+    for (size_t j = 0; j < 3; j++) {
+        setups->edge[j][index] = edge[j];
+        setups->edge_dx[j][index] = edge_dx[j];
+        setups->edge_dy[j][index] = edge_dy[j];
+    }
+
+    vec3 barycoord = barycoord_ss(vec2(min_x + 0.5f, plane_frame_y + 0.5f));
+    setups->set_barycoord(index, barycoord, barycoord_dx, barycoord_dy);
+
+    setups->z[index] = interpolate_z_ss(barycoord);
+    setups->z_dx[index] = interpolate_z_ss(barycoord_dx);
+    setups->z_dy[index] = interpolate_z_ss(barycoord_dy);
+    setups->min_z[index] =
+        std::min({screen_pos(0).z(), screen_pos(1).z(), screen_pos(2).z()});
+
+    return true;
+}
+
+std::tuple<int, int, int, int> Triangle::bounding_box_ss(
+    const Camera &camera) const {
+    const vec3 &p1 = screen_pos(0);
+    const vec3 &p2 = screen_pos(1);
+    const vec3 &p3 = screen_pos(2);
+
+    int min_x = truncate_x_ss(std::floor(std::min({p1.x(), p2.x(), p3.x()})),
+                              camera);
+    int min_y = truncate_y_ss(std::floor(std::min({p1.y(), p2.y(), p3.y()})),
+                              camera);
+    int max_x = truncate_x_ss(std::ceil(std::max({p1.x(), p2.x(), p3.x()})),
+                              camera);
+    int max_y = truncate_y_ss(std::ceil(std::max({p1.y(), p2.y(), p3.y()})),
+                              camera);
+
+    return std::make_tuple(min_x, min_y - camera.offset_y, max_x,
+                           max_y - camera.offset_y);
+}
+
+bool Triangle::calc_edges(const int min_x, const int min_y, int64_t *edge,
+                          int64_t *edge_dx, int64_t *edge_dy) const {
+    // snap the vertices to the sub-pixel grid
+    int64_t x[3], y[3];
+    for (size_t i = 0; i < 3; i++) {
+        x[i] = std::llround(screen_pos(i).x() * coverage::SUBPIXEL_SCALE);
+        y[i] = std::llround(screen_pos(i).y() * coverage::SUBPIXEL_SCALE);
+    }
+
+    int64_t area =
+        (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    if (area == 0) return false;
+
+    // orient the edges so that the inside is positive
+    size_t order[3] = {0, 1, 2};
+    if (area < 0) std::swap(order[1], order[2]);
+
+    int64_t corner_x = min_x * coverage::SUBPIXEL_SCALE;
+    int64_t corner_y = min_y * coverage::SUBPIXEL_SCALE;
+    for (size_t j = 0; j < 3; j++) {
+        size_t a = order[j];
+        size_t b = order[(j + 1) % 3];
+
+        // edge function e(p) = coef_x * (p.x - a.x) + coef_y * (p.y - a.y)
+        int64_t coef_x = y[a] - y[b];
+        int64_t coef_y = x[b] - x[a];
+
+        // top-left rule: the samples exactly on an edge are inside only if
+        // the edge is a left edge or a top edge. An edge shared by two
+        // triangles is left or top in exactly one of them, so each sample is
+        // covered by exactly one triangle.
+        bool is_top_left = coef_x > 0 || (coef_x == 0 && coef_y > 0);
+
+        edge[j] = coef_x * (corner_x - x[a]) + coef_y * (corner_y - y[a]) +
+                  (is_top_left ? 1 : 0);
+        edge_dx[j] = coef_x * coverage::SUBPIXEL_SCALE;
+        edge_dy[j] = coef_y * coverage::SUBPIXEL_SCALE;
+    }
+    return true;
 }
 
 vec3 Triangle::normal() const {
-    return (vertices[0]->pos - vertices[1]->pos)
-        .cross(vertices[0]->pos - vertices[2]->pos)
-        .normalized();
+    return (pos(0) - pos(1)).cross(pos(0) - pos(2)).normalized();
+}
+
+AlphaHierarchy::Coverage Triangle::classify_alpha_ss(
+    const int x, const int y, const vec3 &barycoord, const int min_x,
+    const int min_y, const int max_x, const int max_y) const {
+    // The perspective projection maps the rectangle to a convex quadrilateral
+    // of the triangle plane, so the uv of the samples inside are bounded by
+    // the uv at its corners, as long as the corners are in front of the
+    // camera.
+    vec3 inv_w = vec3(1.f / w(0), 1.f / w(1), 1.f / w(2));
+    vec2 min_uv, max_uv;
+    for (size_t i = 0; i < 4; i++) {
+        int corner_x = i & 1 ? max_x : min_x;
+        int corner_y = i & 2 ? max_y : min_y;
+        vec3 corner = barycoord + barycoord_dx * (corner_x - x - 0.5f) +
+                      barycoord_dy * (corner_y - y - 0.5f);
+        vec3 corner_over_w = corner.cwiseProduct(inv_w);
+        float corner_inv_w = corner_over_w.sum();
+        if (!(corner_inv_w > 0)) return AlphaHierarchy::MIXED;
+
+        vec2 uv = (texcoord(0) * corner_over_w.x() +
+                   texcoord(1) * corner_over_w.y() +
+                   texcoord(2) * corner_over_w.z()) /
+                  corner_inv_w;
+        min_uv = i == 0 ? uv : min_uv.cwiseMin(uv);
+        max_uv = i == 0 ? uv : max_uv.cwiseMax(uv);
+    }
+    return material()->alpha_hierarchy->classify(min_uv, max_uv);
 }
 
 vec3 Triangle::barycoord_ss(const vec2 &screen_pos) const {
-    auto v1 = vec2(vertices[0]->screen_pos.x(), vertices[0]->screen_pos.y());
-    auto v2 = vec2(vertices[1]->screen_pos.x(), vertices[1]->screen_pos.y());
-    auto v3 = vec2(vertices[2]->screen_pos.x(), vertices[2]->screen_pos.y());
+    auto v1 = vec2(this->screen_pos(0).x(), this->screen_pos(0).y());
+    auto v2 = vec2(this->screen_pos(1).x(), this->screen_pos(1).y());
+    auto v3 = vec2(this->screen_pos(2).x(), this->screen_pos(2).y());
 
     float dx1 = v2.x() - v3.x();
     float dy1 = v2.y() - v3.y();
@@ -166,56 +369,81 @@ float Triangle::interpolate_z_ss(const vec3 &barycoord_ss) const {
     float w1 = barycoord_ss.x();
     float w2 = barycoord_ss.y();
     float w3 = barycoord_ss.z();
-    float z1 = vertices[0]->screen_pos.z();
-    float z2 = vertices[1]->screen_pos.z();
-    float z3 = vertices[2]->screen_pos.z();
+    float z1 = screen_pos(0).z();
+    float z2 = screen_pos(1).z();
+    float z3 = screen_pos(2).z();
     return w1 * z1 + w2 * z2 + w3 * z3;
 }
 
-std::tuple<float, float, float> Triangle::corrected_barycoord(
-    const vec3 &barycoord_ss) const {
-    float w1 = vertices[0]->w;
-    float w2 = vertices[1]->w;
-    float w3 = vertices[2]->w;
+unsigned char Triangle::test_samples(const unsigned char covered_flag,
+                                     const vec3 &barycoord,
+                                     const vec3 *barycoord_samples_delta,
+                                     const Camera &camera,
+                                     CullMethod cull_method,
+                                     const bool alpha_test) const {
+    if (!has_normals && !alpha_test) {
+        return covered_flag;
+    }
+
+    // vertex attributes, loaded once for all samples
+    auto normals = std::make_tuple(vertex_normal(0), vertex_normal(1),
+                                   vertex_normal(2));
+    auto positions = std::make_tuple(pos(0), pos(1), pos(2));
+    auto texcoords = std::make_tuple(texcoord(0), texcoord(1), texcoord(2));
+
+    unsigned char passed_flag = 0;
+    // for each MSAA sample, the flags beyond the MSAA level are never set
+    for (size_t i = 0; i < msaa::MAX_MSAA_LEVEL; i++) {
+        if (!(covered_flag & (1u << i))) continue;
 
-    float alpha = barycoord_ss.x();
-    float beta = barycoord_ss.y();
-    float gamma = barycoord_ss.z();
-    float l = alpha / w1 + beta / w2 + gamma / w3;
+        auto w_sample =
+            corrected_barycoord(barycoord + barycoord_samples_delta[i]);
 
-    return std::make_tuple(alpha / w1 / l, beta / w2 / l, gamma / w3 / l);
+        // cull test
+        if (has_normals) {  // if has_normals == false, culling is finished
+                            // at the beginning.
+            vec3 normal = interpolate(normals, w_sample);
+            vec3 pos = interpolate(positions, w_sample);
+            if (is_culled_normal(normal, pos, camera, cull_method)) continue;
+        }
+
+        // alpha test
+        if (alpha_test) {
+            vec2 uv = interpolate(texcoords, w_sample);
+            if (material()->alpha_texture->sample(uv) < EPS) continue;
+        }
+
+        passed_flag |= 1u << i;
+    }
+    return passed_flag;
 }
 
 std::tuple<vec2, vec2> Triangle::calc_uv(
     const std::tuple<float, float, float> &w_shading,
-    const vec3 &barycoord_shading,
-    const std::tuple<vec3, vec3> &barycoord_lod_sample_delta) const {
+    const vec3 &barycoord_shading) const {
     vec2 uv, duv;
-    if (texcoords.empty()) {
+    if (!has_texcoords) {
         uv = vec2(0, 0);
         duv = vec2(1, 1);
     } else {
-        auto [barycoord_lod_sample_x_delta, barycoord_lod_sample_y_delta] =
-            barycoord_lod_sample_delta;
+        // perspective-corrected interpolate
+        uv = interpolate(
+            std::make_tuple(texcoord(0), texcoord(1), texcoord(2)),
+            w_shading);
 
-        auto texcoord_tuple =
-            std::make_tuple(*texcoords[0], *texcoords[1], *texcoords[2]);
+        // uv = (uv / w) / (1 / w), where both (uv / w) and (1 / w) are linear
+        // in the screen space, so
+        // d(uv) = (d(uv / w) - uv * d(1 / w)) / (1 / w)
+        float inv_w = barycoord_shading.x() / w(0) +
+                      barycoord_shading.y() / w(1) +
+                      barycoord_shading.z() / w(2);
+        vec2 ddx = (uv_over_w_dx - uv * inv_w_dx) / inv_w;
+        vec2 ddy = (uv_over_w_dy - uv * inv_w_dy) / inv_w;
 
-        // perspective-corrected interpolate
-        auto w_x = corrected_barycoord(barycoord_shading +
-                                       barycoord_lod_sample_x_delta);
-        auto w_y = corrected_barycoord(barycoord_shading +
-                                       barycoord_lod_sample_y_delta);
-
-        uv = interpolate(texcoord_tuple, w_shading);
-        vec2 ddx =
-            (interpolate(texcoord_tuple, w_x) - uv) / mipmap::LOD_SAMPLE_DELTA;
-        vec2 ddy =
-            (interpolate(texcoord_tuple, w_y) - uv) / mipmap::LOD_SAMPLE_DELTA;
         float du = (std::fabs(ddx.x()) + std::fabs(ddy.x())) / 2.f;
         float dv = (std::fabs(ddx.y()) + std::fabs(ddy.y())) / 2.f;
         duv = vec2(du, dv);
     }
 
     return std::make_tuple(uv, duv);
-}
\ No newline at end of file
+}
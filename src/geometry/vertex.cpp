@@ -1,5 +0,0 @@
-#include "geometry/vertex.hpp"
-
-Vertex::Vertex() {}
-
-Vertex::Vertex(const vec3 &pos) { this->pos = pos; }
\ No newline at end of file
@@ -3,10 +3,16 @@
 
 #include <omp.h>
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <functional>
+#include <iostream>
+#include <limits>
 #include <memory>
+#include <numeric>
+#include <tuple>
+#include <vector>
 
 #include "config.hpp"
 #include "effects/bloom.hpp"
@@ -17,119 +23,251 @@
 #include "geometry/object.hpp"
 #include "global.hpp"
 #include "light/light.hpp"
+#include "rasterizer/atomic_visibility_buffer.hpp"
+#include "rasterizer/hi_z_buffer.hpp"
+#include "rasterizer/tile.hpp"
+#include "rasterizer/tile_bins.hpp"
+#include "rasterizer/triangle_queue.hpp"
+#include "rasterizer/visibility_buffer.hpp"
 #include "scene/camera.hpp"
 #include "scene/scene.hpp"
 #include "shader/fragment_shader.hpp"
+#include "shader/vertex_kernel.hpp"
 #include "shader/vertex_shader.hpp"
 #include "texture/buffer.hpp"
 #include "texture/texture.hpp"
-#include "utils/progress_bar.hpp"
+#include "utils/png_writer.hpp"
 #include "utils/timer.hpp"
 
-void render(Scene &scene) {
-    auto vertex_shader = VertexShader(scene.camera);
-    auto fragment_shader = FragmentShader(scene.camera, scene.lights);
+// Transform the vertices of all objects in the frame of the vertex shader, see
+// VertexKernel, in a single parallel loop over the batches of all meshes.
+void transform_vertices(Scene &scene, const VertexShader &vertex_shader) {
+    std::vector<VertexKernel> kernels;
+    // object and first vertex of each batch
+    std::vector<std::tuple<size_t, size_t>> batches;
+    for (size_t k = 0; k < scene.objects.size(); k++) {
+        const Object &object = scene.objects[k];
+        kernels.emplace_back(object.model_transform, object.normal_transform,
+                             vertex_shader);
+        for (size_t i = 0; i < object.mesh->vertices_size();
+             i += vertex_kernel::BATCH_SIZE) {
+            batches.emplace_back(k, i);
+        }
+    }
 
-    {
-        Timer timer("Vertex shader");
-        for (auto &object : scene.objects) {
-            object.do_model_transform();
+#pragma omp parallel for schedule(dynamic)
+    for (size_t b = 0; b < batches.size(); b++) {
+        auto [k, begin] = batches[b];
+        Mesh *mesh = scene.objects[k].mesh.get();
+        size_t end =
+            std::min(begin + vertex_kernel::BATCH_SIZE, mesh->vertices_size());
+        kernels[k].transform(mesh, begin, end);
+    }
+}
+
+// Move the vertices of the cel-shaded objects outwards for the outline pass,
+// and transform them by the vertex shader again. The vertices are transformed
+// again from the object space for the next frame.
+void transform_outline_vertices(Scene &scene, const Camera &camera,
+                                const VertexShader &vertex_shader) {
+    auto outline_vertex_shader = outline::OutlineVertexShader(camera);
+    for (auto &object : scene.objects) {
+        if (object.shading_type != "cel") continue;
+        Mesh &mesh = *object.mesh;
 #pragma omp parallel for
-            for (auto &vertex : object.vertices) {
-                vertex_shader.shade(vertex.get());
-            }
+        for (size_t i = 0; i < mesh.vertices_size(); i++) {
+            mesh.world_positions[i] = outline_vertex_shader.shade(
+                mesh.world_positions[i],
+                object.world_normal(mesh.smooth_normals[i]));
+            std::tie(mesh.screen_positions[i], mesh.ws[i]) =
+                vertex_shader.shade(mesh.world_positions[i]);
         }
     }
+}
+
+// Render the image of the camera. The vertices of the frame are transformed
+// from the object space, so the scene can be rendered any number of times.
+template <size_t MSAA_LEVEL>
+Texture<vec3> render_frame(Scene &scene, const Camera &camera) {
+    auto vertex_shader = VertexShader(camera);
+    auto fragment_shader = FragmentShader(camera, scene.lights);
+
+    {
+        Timer timer("Vertex transform");
+        transform_vertices(scene, vertex_shader);
+    }
 
-    Buffer buffer;
+    Buffer<MSAA_LEVEL> buffer(scene.msaa_pattern);
 
     {
         Timer timer("Initialize buffer");
 
-        // init mutex
-        buffer.mutex = std::make_shared<Texture<omp_lock_t>>(
-            scene.camera.width, scene.camera.height);
-        for (auto &m : *buffer.mutex) {
-            omp_init_lock(&m);
-        }
+        buffer.z_buffer = std::make_shared<z_buffer_t<MSAA_LEVEL>>(
+            camera.width, camera.height,
+            msaa::texture_init_val<MSAA_LEVEL>(1.f));
 
-        buffer.z_buffer = std::make_shared<z_buffer_t>(
-            scene.camera.width, scene.camera.height,
-            msaa::texture_init_val(1.f));
+        buffer.hi_z_buffer =
+            std::make_shared<HiZBuffer<MSAA_LEVEL>>(buffer.z_buffer,
+                                                    &buffer.lane_offsets);
 
-        buffer.frame_buffer = std::make_shared<frame_buffer_t>(
-            scene.camera.width, scene.camera.height,
-            msaa::texture_init_val(scene.background_color));
+        // the overflow samples are allocated per tile, as each tile is
+        // written by a single thread
+        buffer.frame_buffer = std::make_shared<frame_buffer_t<MSAA_LEVEL>>(
+            camera.width, camera.height, scene.background_color,
+            tile::TILE_SIZE);
 
-        buffer.pos_buffer = std::make_shared<msaa_texture_t<vec3>>(
-            scene.camera.width, scene.camera.height,
-            msaa::texture_init_val(vec3(0, 0, 0)));
+        buffer.pos_buffer =
+            std::make_shared<CompressedMsaaTexture<vec3, MSAA_LEVEL>>(
+                camera.width, camera.height, vec3(0, 0, 0),
+                tile::TILE_SIZE);
 
-        buffer.normal_buffer = std::make_shared<msaa_texture_t<vec3>>(
-            scene.camera.width, scene.camera.height,
-            msaa::texture_init_val(vec3(0, 0, 0)));
+        buffer.normal_buffer =
+            std::make_shared<CompressedMsaaTexture<vec3, MSAA_LEVEL>>(
+                camera.width, camera.height, vec3(0, 0, 0),
+                tile::TILE_SIZE);
 
         buffer.full_covered = std::make_shared<Texture<bool>>(
-            scene.camera.width, scene.camera.height, true);
+            camera.width, camera.height, true);
+
+        if (scene.enable_z_prepass) {
+            buffer.prepass_written_flag =
+                std::make_shared<Texture<unsigned char>>(
+                    camera.width, camera.height, 0);
+        }
+
+        if (scene.enable_deferred_shading) {
+            buffer.visibility_buffer =
+                std::make_shared<msaa_texture_t<Triangle *, MSAA_LEVEL>>(
+                    camera.width, camera.height,
+                    msaa::texture_init_val<MSAA_LEVEL, Triangle *>(nullptr));
+        }
     }
 
+    auto tile_bins = TileBins(camera, scene.enable_deterministic);
+    auto triangle_queue = TriangleQueue();
+
     {
-        Timer timer("Trianglar rasterization");
+        Timer timer("Triangle culling");
         for (auto &object : scene.objects) {
-            ProgressBar progress("Rendering shapes", object.shapes.size());
-            for (auto &shape : object.shapes) {
-#pragma omp parallel for
-                for (auto &triangle : shape.triangles) {
-                    triangle.rasterize(&buffer, &fragment_shader, scene.camera,
-                                       Triangle::CULL_BACK);
-                }
-                progress.update();
+            for (auto &cluster : object.clusters) {
+                triangle_queue.push(&object.triangles[cluster.first],
+                                    cluster.size,
+                                    object.world_bounds(cluster.bounds));
             }
         }
+        size_t culled_clusters =
+            triangle_queue.cull(camera, Triangle::CULL_BACK);
+        std::cout << "Culled clusters: " << culled_clusters
+                  << ", visible triangles: " << triangle_queue.visible_size()
+                  << " / " << triangle_queue.size() << std::endl;
+    }
+
+    if (scene.enable_occlusion_culling) {
+        Timer timer("Occlusion culling");
+        size_t culled_num = triangle_queue.cull_occluded(camera);
+        std::cout << "Occluded batches: " << culled_num
+                  << ", visible triangles: " << triangle_queue.visible_size()
+                  << std::endl;
+    }
+
+    // the atomic rasterization sets up the triangles itself without binning
+    if (!scene.enable_atomic_rasterization) {
+        Timer timer("Triangle binning");
+        triangle_queue.for_each_visible(
+            [&](Triangle *triangle, const uint32_t order) {
+                tile_bins.bin(triangle, order, camera);
+            });
+    }
+
+    auto depth_test = coverage::DEPTH_LESS;
+    if (scene.enable_z_prepass) {
+        Timer timer("Z prepass");
+        tile_bins.rasterize_depth(&buffer, camera, Triangle::CULL_BACK);
+        depth_test = coverage::DEPTH_EQUAL;
+    }
+
+    if (scene.enable_atomic_rasterization) {
+        {
+            Timer timer("Trianglar rasterization");
+            auto atomic_buffer = AtomicVisibilityBuffer<MSAA_LEVEL>(
+                camera.width, camera.height);
+            atomic_buffer.rasterize(&buffer, &triangle_queue, camera,
+                                    Triangle::CULL_BACK);
+            atomic_buffer.resolve(&buffer, triangle_queue);
+        }
+        {
+            Timer timer("Deferred shading");
+            visibility::resolve(&buffer, &fragment_shader, camera);
+        }
+    } else if (scene.enable_deferred_shading) {
+        {
+            Timer timer("Trianglar rasterization");
+            tile_bins.rasterize_visibility(&buffer, camera,
+                                           Triangle::CULL_BACK, depth_test);
+        }
+        {
+            Timer timer("Deferred shading");
+            visibility::resolve(&buffer, &fragment_shader, camera);
+        }
+    } else {
+        Timer timer("Trianglar rasterization");
+        tile_bins.rasterize(&buffer, &fragment_shader, camera,
+                            Triangle::CULL_BACK, depth_test);
     }
 
     {
         Timer timer("Outline pass");
-        auto outline_vertex_shader = outline::OutlineVertexShader(scene.camera);
-        auto outline_fragment_shader =
-            outline::OutlineFragmentShader(scene.camera);
+        auto outline_fragment_shader = outline::OutlineFragmentShader(camera);
 
+        tile_bins.clear();
+        triangle_queue.clear();
+
+        transform_outline_vertices(scene, camera, vertex_shader);
         for (auto &object : scene.objects) {
             if (object.shading_type != "cel") continue;
-#pragma omp parallel for
-            for (auto &vertex : object.vertices) {
-                outline_vertex_shader.shade(vertex.get());
-                vertex_shader.shade(vertex.get());
-            }
 
+            // the clusters do not bound the moved vertices
             for (auto &shape : object.shapes) {
-#pragma omp parallel for
-                for (auto &triangle : shape.triangles) {
-                    triangle.rasterize(&buffer, &outline_fragment_shader,
-                                       scene.camera, Triangle::CULL_FRONT);
-                }
+                triangle_queue.push(&object.triangles[shape.first],
+                                    shape.size);
             }
         }
+        triangle_queue.cull(camera, Triangle::CULL_FRONT);
+        triangle_queue.for_each_visible(
+            [&](Triangle *triangle, const uint32_t order) {
+                tile_bins.bin(triangle, order, camera);
+            });
+
+        tile_bins.rasterize(&buffer, &outline_fragment_shader, camera,
+                            Triangle::CULL_FRONT);
+    }
+
+    // depth of the pixels and the samples at the background, for the post
+    // effects
+    Texture<float> z_buffer_result;
+    {
+        Timer timer("Depth resolve");
+        buffer.background_flag = std::make_shared<Texture<unsigned char>>(
+            camera.width, camera.height);
+        z_buffer_result = buffer.hi_z_buffer->resolve(
+            *buffer.full_covered, buffer.background_flag.get());
     }
 
     if (scene.enable_rimlight) {
         Timer timer("Rimlight");
-        rimlight::rimlight(&buffer, scene.camera);
+        rimlight::rimlight(&buffer, camera);
     }
 
     Texture<vec3> frame_result;
     {
         Timer timer("MSAA filter");
-        frame_result =
-            msaa::msaa_filter(*buffer.full_covered, *buffer.frame_buffer);
+        frame_result = msaa::msaa_filter(*buffer.frame_buffer);
     }
 
     {
         Timer timer("SSAO filter");
-        Texture<float> z_buffer_result =
-            msaa::msaa_filter(*buffer.full_covered, *buffer.z_buffer);
         frame_result = ssao::ssao_filter(&buffer, frame_result, z_buffer_result,
-                                         &vertex_shader);
+                                         &vertex_shader, camera.offset_y);
     }
 
     if (scene.enable_bloom) {
@@ -139,14 +277,83 @@ void render(Scene &scene) {
                                 scene.bloom_radius, scene.bloom_iteration);
     }
 
-    {
+    return frame_result;
+}
+
+// Return the minimum w of the vertices of the triangles in the view of the
+// camera, only of the cel-shaded objects if `cel_only`.
+float min_visible_w(const Scene &scene, const Camera &camera,
+                    const bool cel_only) {
+    float min_w = std::numeric_limits<float>::infinity();
+    for (auto &object : scene.objects) {
+        if (cel_only && object.shading_type != "cel") continue;
+#pragma omp parallel for reduction(min : min_w)
+        for (size_t i = 0; i < object.triangles.size(); i++) {
+            const Triangle &triangle = object.triangles[i];
+            if (triangle.is_culled(camera, Triangle::NO_CULL)) continue;
+            min_w = std::min({min_w, triangle.w(0), triangle.w(1),
+                              triangle.w(2)});
+        }
+    }
+    return min_w;
+}
+
+// Return the number of rows rendered above and below each band, so that the
+// post effects of the band read the same pixels as of the whole frame.
+int band_halo(Scene &scene) {
+    // nearest vertex of the triangles in the view, including the outlines,
+    // which bounds the w of all fragments as 1 / w is linear in the screen
+    // space
+    const Camera &camera = scene.camera;
+    auto vertex_shader = VertexShader(camera);
+    transform_vertices(scene, vertex_shader);
+    float min_w = min_visible_w(scene, camera, false);
+    transform_outline_vertices(scene, camera, vertex_shader);
+    min_w = std::min(min_w, min_visible_w(scene, camera, true));
+
+    int halo = std::max(rimlight::halo(), ssao::halo(scene.camera, min_w));
+    if (scene.enable_bloom) {
+        halo += bloom::halo(scene.bloom_radius, scene.bloom_iteration);
+    }
+    return halo;
+}
+
+template <size_t MSAA_LEVEL>
+void render(Scene &scene) {
+    if (!scene.enable_band_rendering) {
+        Texture<vec3> frame_result =
+            render_frame<MSAA_LEVEL>(scene, scene.camera);
+
         Timer timer("Save image");
         frame_result.write_img("out.png", false);
+        return;
     }
 
-    // destroy mutex
-    for (auto &m : *buffer.mutex) {
-        omp_destroy_lock(&m);
+    // the bands and the halos start at the multiples of `align` rows, so that
+    // the tiles of the bands are the tiles of the frame, and the bloom
+    // pyramids of the bands are aligned with the pyramid of the frame
+    int align = std::lcm(tile::TILE_SIZE,
+                         scene.enable_bloom ? 1 << scene.bloom_iteration : 1);
+    int band_height = (scene.band_height + align - 1) / align * align;
+    int halo = (band_halo(scene) + align - 1) / align * align;
+    std::cout << "Band height: " << band_height << ", halo: " << halo
+              << std::endl;
+
+    const int frame_height = scene.camera.height;
+    auto writer = PngWriter("out.png", scene.camera.width, frame_height);
+    for (int band_y = 0; band_y < frame_height; band_y += band_height) {
+        int band_max_y = std::min(band_y + band_height, frame_height);
+        int window_y = std::max(band_y - halo, 0);
+        int window_max_y = std::min(band_max_y + halo, frame_height);
+        std::cout << "Band: [" << band_y << ", " << band_max_y << ")"
+                  << std::endl;
+
+        Texture<vec3> frame_result = render_frame<MSAA_LEVEL>(
+            scene, scene.camera.band(window_y, window_max_y));
+
+        Timer timer("Save band");
+        writer.write_rows(frame_result, band_y - window_y,
+                          band_max_y - band_y, false);
     }
 }
 
@@ -174,7 +381,20 @@ int main(int argc, char *argv[]) {
 
     {  // render
         Timer timer("Frame render");
-        render(scene);
+        switch (scene.msaa_level) {
+            case 1:
+                render<1>(scene);
+                break;
+            case 2:
+                render<2>(scene);
+                break;
+            case 4:
+                render<4>(scene);
+                break;
+            case 8:
+                render<8>(scene);
+                break;
+        }
     }
 
     return 0;
@@ -0,0 +1,156 @@
+#include "rasterizer/occlusion_buffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+ScreenBounds::ScreenBounds()
+    : min_x(std::numeric_limits<float>::infinity()),
+      min_y(std::numeric_limits<float>::infinity()),
+      max_x(-std::numeric_limits<float>::infinity()),
+      max_y(-std::numeric_limits<float>::infinity()),
+      min_z(std::numeric_limits<float>::infinity()) {}
+
+void ScreenBounds::extend(const Triangle &triangle) {
+    for (size_t i = 0; i < 3; i++) {
+        const vec3 &screen_pos = triangle.screen_pos(i);
+        min_x = std::min(min_x, screen_pos.x());
+        min_y = std::min(min_y, screen_pos.y());
+        max_x = std::max(max_x, screen_pos.x());
+        max_y = std::max(max_y, screen_pos.y());
+        min_z = std::min(min_z, screen_pos.z());
+    }
+}
+
+OcclusionBuffer::OcclusionBuffer(const Camera &camera,
+                                 const std::vector<Triangle *> &triangles)
+    : cells_x((camera.width + occlusion::CELL_SIZE - 1) / occlusion::CELL_SIZE),
+      cells_y((camera.height + occlusion::CELL_SIZE - 1) /
+              occlusion::CELL_SIZE),
+      offset_y(camera.offset_y),
+      max_z(cells_x, cells_y, 1.f) {
+    // A triangle containing a square of side CELL_SIZE has at least twice its
+    // area, so the smaller ones never cover a cell.
+    const float min_area = 4.f * occlusion::CELL_SIZE * occlusion::CELL_SIZE;
+
+    // occluders with their doubled screen-space area
+    std::vector<std::pair<float, const Triangle *>> occluders;
+    for (const Triangle *triangle : triangles) {
+        const vec3 &p1 = triangle->screen_pos(0);
+        const vec3 &p2 = triangle->screen_pos(1);
+        const vec3 &p3 = triangle->screen_pos(2);
+        float area = std::fabs((p2.x() - p1.x()) * (p3.y() - p1.y()) -
+                               (p2.y() - p1.y()) * (p3.x() - p1.x()));
+        if (area >= min_area && is_occluder(*triangle, camera)) {
+            occluders.emplace_back(area, triangle);
+        }
+    }
+
+    // the largest occluders first
+    size_t occluders_num = std::min(occluders.size(), occlusion::MAX_OCCLUDERS);
+    std::partial_sort(
+        occluders.begin(), occluders.begin() + occluders_num, occluders.end(),
+        [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    for (size_t i = 0; i < occluders_num; i++) {
+        rasterize(*occluders[i].second);
+    }
+}
+
+bool OcclusionBuffer::is_occluded(const ScreenBounds &bounds) const {
+    int min_cell_x = std::max(
+        static_cast<int>(std::floor(bounds.min_x / occlusion::CELL_SIZE)), 0);
+    int min_cell_y = std::max(
+        static_cast<int>(
+            std::floor((bounds.min_y - offset_y) / occlusion::CELL_SIZE)),
+        0);
+    int max_cell_x = std::min(
+        static_cast<int>(std::floor(bounds.max_x / occlusion::CELL_SIZE)),
+        cells_x - 1);
+    int max_cell_y = std::min(
+        static_cast<int>(
+            std::floor((bounds.max_y - offset_y) / occlusion::CELL_SIZE)),
+        cells_y - 1);
+    if (min_cell_x > max_cell_x || min_cell_y > max_cell_y) return false;
+
+    for (int cell_y = min_cell_y; cell_y <= max_cell_y; cell_y++) {
+        for (int cell_x = min_cell_x; cell_x <= max_cell_x; cell_x++) {
+            if (!(bounds.min_z > max_z.at(cell_x, cell_y))) return false;
+        }
+    }
+    return true;
+}
+
+bool OcclusionBuffer::is_occluder(const Triangle &triangle,
+                                  const Camera &camera) {
+    if (triangle.alpha_coverage != AlphaHierarchy::OPAQUE) return false;
+
+    // The interpolated normal and position are weighted sums of the vertex
+    // ones with non-negative weights, so the normal at any point faces the
+    // camera if each vertex normal faces the camera from each vertex.
+    if (!triangle.has_normals) return true;
+    for (size_t i = 0; i < 3; i++) {
+        for (size_t j = 0; j < 3; j++) {
+            if (!(triangle.vertex_normal(i).dot(camera.pos -
+                                                triangle.pos(j)) > 0))
+                return false;
+        }
+    }
+    return true;
+}
+
+void OcclusionBuffer::rasterize(const Triangle &triangle) {
+    const vec3 &p1 = triangle.screen_pos(0);
+    const vec3 &p2 = triangle.screen_pos(1);
+    const vec3 &p3 = triangle.screen_pos(2);
+    float area = (p2.x() - p1.x()) * (p3.y() - p1.y()) -
+                 (p2.y() - p1.y()) * (p3.x() - p1.x());
+    if (area == 0) return;
+
+    // screen-space barycentric coordinate at the point
+    auto barycoord = [&](const float x, const float y) {
+        float w1 =
+            ((p2.x() - x) * (p3.y() - y) - (p2.y() - y) * (p3.x() - x)) / area;
+        float w2 =
+            ((p3.x() - x) * (p1.y() - y) - (p3.y() - y) * (p1.x() - x)) / area;
+        return vec3(w1, w2, 1.f - w1 - w2);
+    };
+
+    // cells entirely inside the bounding box, whose rows start at the row
+    // offset_y of the frame
+    float min_x = std::min({p1.x(), p2.x(), p3.x()});
+    float min_y = std::min({p1.y(), p2.y(), p3.y()}) - offset_y;
+    float max_x = std::max({p1.x(), p2.x(), p3.x()});
+    float max_y = std::max({p1.y(), p2.y(), p3.y()}) - offset_y;
+    int min_cell_x = std::max(
+        static_cast<int>(std::ceil(min_x / occlusion::CELL_SIZE)), 0);
+    int min_cell_y = std::max(
+        static_cast<int>(std::ceil(min_y / occlusion::CELL_SIZE)), 0);
+    int max_cell_x = std::min(
+        static_cast<int>(std::floor(max_x / occlusion::CELL_SIZE)), cells_x);
+    int max_cell_y = std::min(
+        static_cast<int>(std::floor(max_y / occlusion::CELL_SIZE)), cells_y);
+
+    for (int cell_y = min_cell_y; cell_y < max_cell_y; cell_y++) {
+        for (int cell_x = min_cell_x; cell_x < max_cell_x; cell_x++) {
+            // the cell is inside the triangle if all its corners are, and the
+            // depth plane is the farthest at one of the corners
+            bool covered = true;
+            float cell_max_z = 0;
+            for (int corner = 0; corner < 4 && covered; corner++) {
+                vec3 w = barycoord(
+                    (cell_x + (corner & 1)) * occlusion::CELL_SIZE,
+                    (cell_y + (corner >> 1)) * occlusion::CELL_SIZE +
+                        offset_y);
+                if (!(w.minCoeff() > 0)) covered = false;
+                float z = w.x() * p1.z() + w.y() * p2.z() + w.z() * p3.z();
+                cell_max_z = std::max(cell_max_z, z);
+            }
+            if (!covered) continue;
+
+            float &cell_z = max_z.at(cell_x, cell_y);
+            cell_z = std::min(cell_z, cell_max_z + occlusion::DEPTH_BIAS);
+        }
+    }
+}
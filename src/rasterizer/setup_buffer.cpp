@@ -0,0 +1,43 @@
+#include "rasterizer/setup_buffer.hpp"
+
+#include <algorithm>
+
+size_t SetupBuffer::size() const { return records_num; }
+
+void SetupBuffer::clear() { records_num = 0; }
+
+size_t SetupBuffer::append(Triangle *triangle) {
+    if (records_num == triangles.size()) {
+        size_t capacity =
+            std::max(2 * records_num, setup_buffer::MIN_CAPACITY);
+        for_each_array([&](auto &array) { array.resize(capacity); });
+    }
+    triangles[records_num] = triangle;
+    return records_num++;
+}
+
+void SetupBuffer::set_barycoord(const size_t index, const vec3 &barycoord,
+                                const vec3 &barycoord_dx,
+                                const vec3 &barycoord_dy) {
+    w1[index] = barycoord.x();
+    w1_dx[index] = barycoord_dx.x();
+    w1_dy[index] = barycoord_dy.x();
+    w2[index] = barycoord.y();
+    w2_dx[index] = barycoord_dx.y();
+    w2_dy[index] = barycoord_dy.y();
+    w3[index] = barycoord.z();
+    w3_dx[index] = barycoord_dx.z();
+    w3_dy[index] = barycoord_dy.z();
+}
+
+vec3 SetupBuffer::barycoord(const size_t index) const {
+    return vec3(w1[index], w2[index], w3[index]);
+}
+
+vec3 SetupBuffer::barycoord_dx(const size_t index) const {
+    return vec3(w1_dx[index], w2_dx[index], w3_dx[index]);
+}
+
+vec3 SetupBuffer::barycoord_dy(const size_t index) const {
+    return vec3(w1_dy[index], w2_dy[index], w3_dy[index]);
+}
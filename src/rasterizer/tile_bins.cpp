@@ -0,0 +1,63 @@
+#include "rasterizer/tile_bins.hpp"
+
+#include <omp.h>
+
+#include <algorithm>
+
+TileBins::TileBins(const Camera &camera, const bool deterministic) {
+    width = camera.width;
+    height = camera.height;
+    this->deterministic = deterministic;
+    tiles_x = (width + tile::TILE_SIZE - 1) / tile::TILE_SIZE;
+    tiles_y = (height + tile::TILE_SIZE - 1) / tile::TILE_SIZE;
+
+    setup_buffers.resize(omp_get_max_threads());
+    bins.resize(omp_get_max_threads());
+    for (auto &thread_bins : bins) {
+        thread_bins.resize(tiles_x * tiles_y);
+    }
+}
+
+void TileBins::clear() {
+    for (auto &thread_setups : setup_buffers) {
+        thread_setups.clear();
+    }
+    for (auto &thread_bins : bins) {
+        for (auto &bin : thread_bins) {
+            bin.clear();
+        }
+    }
+}
+
+void TileBins::bin(Triangle *triangle, const uint32_t order,
+                   const Camera &camera) {
+    int thread_id = omp_get_thread_num();
+    auto &thread_setups = setup_buffers[thread_id];
+    if (!triangle->setup(camera, &thread_setups)) return;
+
+    uint32_t index = thread_setups.size() - 1;
+    thread_setups.order[index] = order;
+    auto &thread_bins = bins[thread_id];
+
+    int tile_min_x = thread_setups.min_x[index] / tile::TILE_SIZE;
+    int tile_min_y = thread_setups.min_y[index] / tile::TILE_SIZE;
+    int tile_max_x = (thread_setups.max_x[index] - 1) / tile::TILE_SIZE;
+    int tile_max_y = (thread_setups.max_y[index] - 1) / tile::TILE_SIZE;
+    for (int tile_y = tile_min_y; tile_y <= tile_max_y; tile_y++) {
+        for (int tile_x = tile_min_x; tile_x <= tile_max_x; tile_x++) {
+            thread_bins[tile_y * tiles_x + tile_x].push_back(index);
+        }
+    }
+}
+
+Tile TileBins::tile(const int tile_id) const {
+    int tile_x = tile_id % tiles_x;
+    int tile_y = tile_id / tiles_x;
+
+    Tile tile;
+    tile.min_x = tile_x * tile::TILE_SIZE;
+    tile.min_y = tile_y * tile::TILE_SIZE;
+    tile.max_x = std::min(tile.min_x + tile::TILE_SIZE, width);
+    tile.max_y = std::min(tile.min_y + tile::TILE_SIZE, height);
+    return tile;
+}
@@ -0,0 +1,125 @@
+#include "rasterizer/triangle_queue.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "rasterizer/occlusion_buffer.hpp"
+
+void TriangleQueue::clear() {
+    batches.clear();
+    triangles_num = 0;
+    visible.clear();
+    visible_offsets.clear();
+}
+
+void TriangleQueue::push(Triangle *first, const size_t size) {
+    for (size_t begin = 0; begin < size; begin += triangle_queue::BATCH_SIZE) {
+        size_t batch_size = std::min(triangle_queue::BATCH_SIZE, size - begin);
+        batches.push_back({first + begin, batch_size, false, ClusterBounds()});
+    }
+    triangles_num += size;
+}
+
+void TriangleQueue::push(Triangle *first, const size_t size,
+                         const ClusterBounds &bounds) {
+    batches.push_back({first, size, true, bounds});
+    triangles_num += size;
+}
+
+size_t TriangleQueue::size() const { return triangles_num; }
+
+size_t TriangleQueue::visible_size() const { return visible.size(); }
+
+Triangle *TriangleQueue::visible_at(const size_t order) const {
+    return visible[order];
+}
+
+size_t TriangleQueue::cull(const Camera &camera,
+                           Triangle::CullMethod cull_method) {
+    auto frustum = Frustum(camera);
+
+    // cull flags of the triangles in each batch, and the number of survivors
+    std::vector<unsigned char> culled(batches.size() *
+                                      triangle_queue::BATCH_SIZE);
+    std::vector<size_t> offsets(batches.size() + 1, 0);
+    size_t culled_clusters = 0;
+
+#pragma omp parallel for schedule(dynamic) reduction(+ : culled_clusters)
+    for (size_t i = 0; i < batches.size(); i++) {
+        const Batch &batch = batches[i];
+        unsigned char *batch_culled = &culled[i * triangle_queue::BATCH_SIZE];
+        if (batch.has_bounds &&
+            batch.bounds.is_culled(frustum, camera, cull_method)) {
+            std::fill(batch_culled, batch_culled + batch.size, 1);
+            culled_clusters++;
+            continue;
+        }
+
+        size_t count = 0;
+        for (size_t j = 0; j < batch.size; j++) {
+            batch_culled[j] = batch.first[j].is_culled(camera, cull_method);
+            count += !batch_culled[j];
+        }
+        offsets[i + 1] = count;
+    }
+
+    // exclusive prefix sum of the survivors per batch, which gives the
+    // position of each batch in the compacted list
+    for (size_t i = 0; i < batches.size(); i++) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    visible.resize(offsets[batches.size()]);
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < batches.size(); i++) {
+        const Batch &batch = batches[i];
+        const unsigned char *batch_culled =
+            &culled[i * triangle_queue::BATCH_SIZE];
+        size_t index = offsets[i];
+        for (size_t j = 0; j < batch.size; j++) {
+            if (!batch_culled[j]) visible[index++] = batch.first + j;
+        }
+    }
+    visible_offsets = std::move(offsets);
+
+    return culled_clusters;
+}
+
+size_t TriangleQueue::cull_occluded(const Camera &camera) {
+    auto occlusion_buffer = OcclusionBuffer(camera, visible);
+
+    // number of survivors kept in each batch
+    std::vector<size_t> offsets(batches.size() + 1, 0);
+
+#pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < batches.size(); i++) {
+        size_t begin = visible_offsets[i];
+        size_t end = visible_offsets[i + 1];
+        if (begin == end) continue;
+
+        ScreenBounds bounds;
+        for (size_t j = begin; j < end; j++) {
+            bounds.extend(*visible[j]);
+        }
+        if (!occlusion_buffer.is_occluded(bounds)) offsets[i + 1] = end - begin;
+    }
+
+    size_t culled_num = 0;
+    for (size_t i = 0; i < batches.size(); i++) {
+        if (visible_offsets[i] != visible_offsets[i + 1] && offsets[i + 1] == 0)
+            culled_num++;
+        offsets[i + 1] += offsets[i];
+    }
+
+    // compact the kept batches in place, which only moves them forward
+    for (size_t i = 0; i < batches.size(); i++) {
+        if (offsets[i + 1] == offsets[i]) continue;
+        std::copy(visible.begin() + visible_offsets[i],
+                  visible.begin() + visible_offsets[i + 1],
+                  visible.begin() + offsets[i]);
+    }
+    visible.resize(offsets[batches.size()]);
+    visible_offsets = std::move(offsets);
+
+    return culled_num;
+}
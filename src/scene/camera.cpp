@@ -14,6 +14,7 @@ Camera::Camera(const vec3 &pos, const vec3 &rotation, const float fov,
     this->width = width;
     this->height = height;
     this->aspect = static_cast<float>(width) / static_cast<float>(height);
+    this->frame_height = height;
 
     DirectionTransform direction_transform;
     direction_transform.rotation(rotation);
@@ -23,4 +24,11 @@ Camera::Camera(const vec3 &pos, const vec3 &rotation, const float fov,
     this->up_dir = direction_transform
                        .transform(vec3(0, 1, 0))  // up to Y
                        .normalized();
+}
+
+Camera Camera::band(const int min_y, const int max_y) const {
+    Camera camera = *this;
+    camera.height = max_y - min_y;
+    camera.offset_y = offset_y + min_y;
+    return camera;
 }
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include "shader/vertex_kernel.hpp"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+
+namespace {
+
+// Return a * b + c, rounded once if FMA is enabled.
+inline float madd(const float a, const float b, const float c) {
+#if defined(__AVX2__) && defined(__FMA__)
+    return std::fma(a, b, c);
+#else
+    return a * b + c;
+#endif
+}
+
+// Return the product of a row of a 4x4 matrix and (x, y, z, 1).
+inline float dot4(const float *row, const float x, const float y,
+                  const float z) {
+    return madd(row[2], z, madd(row[1], y, row[0] * x)) + row[3];
+}
+
+// Return the product of a row of a 3x3 matrix and (x, y, z).
+inline float dot3(const float *row, const float x, const float y,
+                  const float z) {
+    return row[0] * x + madd(row[2], z, row[1] * y);
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+inline __m256 dot4(const __m256 *row, const __m256 x, const __m256 y,
+                   const __m256 z) {
+    return _mm256_add_ps(
+        _mm256_fmadd_ps(row[2], z,
+                        _mm256_fmadd_ps(row[1], y, _mm256_mul_ps(row[0], x))),
+        row[3]);
+}
+
+inline __m256 dot3(const __m256 *row, const __m256 x, const __m256 y,
+                   const __m256 z) {
+    return _mm256_add_ps(_mm256_mul_ps(row[0], x),
+                         _mm256_fmadd_ps(row[2], z, _mm256_mul_ps(row[1], y)));
+}
+
+// Load 8 consecutive vec3 into a register per coordinate.
+inline void load_soa(const vec3 *src, __m256 *x, __m256 *y, __m256 *z) {
+    const float *p = src->data();
+    // the lanes 0-3 and 4-7 hold the vectors 0-3 and 4-7
+    __m256 m03 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)),
+                                      _mm_loadu_ps(p + 12), 1);
+    __m256 m14 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(p + 4)), _mm_loadu_ps(p + 16), 1);
+    __m256 m25 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(p + 8)), _mm_loadu_ps(p + 20), 1);
+
+    // per 128-bit lane, m03 = x0 y0 z0 x1, m14 = y1 z1 x2 y2 and
+    // m25 = z2 x3 y3 z3
+    __m256 xy = _mm256_shuffle_ps(m14, m25, _MM_SHUFFLE(2, 1, 3, 2));
+    __m256 yz = _mm256_shuffle_ps(m03, m14, _MM_SHUFFLE(1, 0, 2, 1));
+    *x = _mm256_shuffle_ps(m03, xy, _MM_SHUFFLE(2, 0, 3, 0));
+    *y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+    *z = _mm256_shuffle_ps(yz, m25, _MM_SHUFFLE(3, 0, 3, 1));
+}
+
+// Store a register per coordinate into 8 consecutive vec3, the inverse of
+// load_soa().
+inline void store_soa(vec3 *dst, const __m256 x, const __m256 y,
+                      const __m256 z) {
+    float *p = dst->data();
+    __m256 xy = _mm256_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 yz = _mm256_shuffle_ps(y, z, _MM_SHUFFLE(3, 1, 3, 1));
+    __m256 zx = _mm256_shuffle_ps(z, x, _MM_SHUFFLE(3, 1, 2, 0));
+    __m256 m03 = _mm256_shuffle_ps(xy, zx, _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 m14 = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+    __m256 m25 = _mm256_shuffle_ps(zx, yz, _MM_SHUFFLE(3, 1, 3, 1));
+
+    _mm_storeu_ps(p, _mm256_castps256_ps128(m03));
+    _mm_storeu_ps(p + 4, _mm256_castps256_ps128(m14));
+    _mm_storeu_ps(p + 8, _mm256_castps256_ps128(m25));
+    _mm_storeu_ps(p + 12, _mm256_extractf128_ps(m03, 1));
+    _mm_storeu_ps(p + 16, _mm256_extractf128_ps(m14, 1));
+    _mm_storeu_ps(p + 20, _mm256_extractf128_ps(m25, 1));
+}
+#endif
+
+}  // namespace
+
+VertexKernel::VertexKernel(const PositionTransform &model_transform,
+                           const NormalTransform &normal_transform,
+                           const VertexShader &vertex_shader) {
+    const mat4 &model_matrix = model_transform.get_matrix();
+    const mat3 &normal_matrix = normal_transform.get_matrix();
+    const mat4 &screen_matrix = vertex_shader.position_transform.get_matrix();
+    for (size_t r = 0; r < 4; r++) {
+        for (size_t c = 0; c < 4; c++) {
+            model[r][c] = model_matrix(r, c);
+            screen[r][c] = screen_matrix(r, c);
+        }
+    }
+    for (size_t r = 0; r < 3; r++) {
+        for (size_t c = 0; c < 3; c++) {
+            normal[r][c] = normal_matrix(r, c);
+        }
+    }
+}
+
+void VertexKernel::transform(Mesh *mesh, const size_t begin,
+                             const size_t end) const {
+    size_t i = begin;
+
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 model_rows[4][4], normal_rows[3][3], screen_rows[4][4];
+    for (size_t r = 0; r < 4; r++) {
+        for (size_t c = 0; c < 4; c++) {
+            model_rows[r][c] = _mm256_set1_ps(model[r][c]);
+            screen_rows[r][c] = _mm256_set1_ps(screen[r][c]);
+        }
+    }
+    for (size_t r = 0; r < 3; r++) {
+        for (size_t c = 0; c < 3; c++) {
+            normal_rows[r][c] = _mm256_set1_ps(normal[r][c]);
+        }
+    }
+
+    for (; i + vertex_kernel::LANES <= end; i += vertex_kernel::LANES) {
+        __m256 x, y, z;
+
+        // world-space position
+        load_soa(&mesh->positions[i], &x, &y, &z);
+        __m256 model_w = dot4(model_rows[3], x, y, z);
+        __m256 world_x = _mm256_div_ps(dot4(model_rows[0], x, y, z), model_w);
+        __m256 world_y = _mm256_div_ps(dot4(model_rows[1], x, y, z), model_w);
+        __m256 world_z = _mm256_div_ps(dot4(model_rows[2], x, y, z), model_w);
+        store_soa(&mesh->world_positions[i], world_x, world_y, world_z);
+
+        // screen-space position and w
+        __m256 w = dot4(screen_rows[3], world_x, world_y, world_z);
+        __m256 screen_x =
+            _mm256_div_ps(dot4(screen_rows[0], world_x, world_y, world_z), w);
+        __m256 screen_y =
+            _mm256_div_ps(dot4(screen_rows[1], world_x, world_y, world_z), w);
+        __m256 screen_z =
+            _mm256_div_ps(dot4(screen_rows[2], world_x, world_y, world_z), w);
+        store_soa(&mesh->screen_positions[i], screen_x, screen_y, screen_z);
+        _mm256_storeu_ps(&mesh->ws[i], w);
+
+        // world-space normal, normalized unless zero
+        load_soa(&mesh->normals[i], &x, &y, &z);
+        __m256 normal_x = dot3(normal_rows[0], x, y, z);
+        __m256 normal_y = dot3(normal_rows[1], x, y, z);
+        __m256 normal_z = dot3(normal_rows[2], x, y, z);
+        const __m256 normal_lanes[3] = {normal_x, normal_y, normal_z};
+        __m256 squared_norm = dot3(normal_lanes, normal_x, normal_y,
+                                   normal_z);
+        __m256 norm = _mm256_sqrt_ps(squared_norm);
+        __m256 nonzero =
+            _mm256_cmp_ps(squared_norm, _mm256_setzero_ps(), _CMP_GT_OQ);
+        normal_x = _mm256_blendv_ps(normal_x, _mm256_div_ps(normal_x, norm),
+                                    nonzero);
+        normal_y = _mm256_blendv_ps(normal_y, _mm256_div_ps(normal_y, norm),
+                                    nonzero);
+        normal_z = _mm256_blendv_ps(normal_z, _mm256_div_ps(normal_z, norm),
+                                    nonzero);
+        store_soa(&mesh->world_normals[i], normal_x, normal_y, normal_z);
+    }
+#endif
+
+    for (; i < end; i++) {
+        transform_one(mesh, i);
+    }
+}
+
+void VertexKernel::transform_one(Mesh *mesh, const size_t i) const {
+    const vec3 &pos = mesh->positions[i];
+    float model_w = dot4(model[3], pos.x(), pos.y(), pos.z());
+    vec3 world_pos(dot4(model[0], pos.x(), pos.y(), pos.z()) / model_w,
+                   dot4(model[1], pos.x(), pos.y(), pos.z()) / model_w,
+                   dot4(model[2], pos.x(), pos.y(), pos.z()) / model_w);
+    mesh->world_positions[i] = world_pos;
+
+    float w = dot4(screen[3], world_pos.x(), world_pos.y(), world_pos.z());
+    mesh->screen_positions[i] = vec3(
+        dot4(screen[0], world_pos.x(), world_pos.y(), world_pos.z()) / w,
+        dot4(screen[1], world_pos.x(), world_pos.y(), world_pos.z()) / w,
+        dot4(screen[2], world_pos.x(), world_pos.y(), world_pos.z()) / w);
+    mesh->ws[i] = w;
+
+    const vec3 &n = mesh->normals[i];
+    vec3 world_normal(dot3(normal[0], n.x(), n.y(), n.z()),
+                      dot3(normal[1], n.x(), n.y(), n.z()),
+                      dot3(normal[2], n.x(), n.y(), n.z()));
+    float squared_norm = dot3(world_normal.data(), world_normal.x(),
+                              world_normal.y(), world_normal.z());
+    if (squared_norm > 0) world_normal /= std::sqrt(squared_norm);
+    mesh->world_normals[i] = world_normal;
+}
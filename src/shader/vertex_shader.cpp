@@ -12,11 +12,10 @@ VertexShader::VertexShader(const Camera &camera) {
     position_transform.ndc_to_screen(camera);
 }
 
-void VertexShader::shade(Vertex *vertex) {
-    vec4 screen_pos = position_transform.transform(
-        vec4(vertex->pos.x(), vertex->pos.y(), vertex->pos.z(), 1));
-    vertex->screen_pos =
-        (vec3(screen_pos.x(), screen_pos.y(), screen_pos.z()) /
-         screen_pos.w());
-    vertex->w = screen_pos.w();
+std::tuple<vec3, float> VertexShader::shade(const vec3 &pos) const {
+    vec4 clip_pos =
+        position_transform.transform(vec4(pos.x(), pos.y(), pos.z(), 1));
+    vec3 screen_pos =
+        vec3(clip_pos.x(), clip_pos.y(), clip_pos.z()) / clip_pos.w();
+    return std::make_tuple(screen_pos, clip_pos.w());
 }
\ No newline at end of file
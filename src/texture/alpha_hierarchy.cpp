@@ -0,0 +1,120 @@
+#include "texture/alpha_hierarchy.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+AlphaHierarchy::AlphaHierarchy(const Texture<float> &alpha_texture)
+    : width(alpha_texture.width), height(alpha_texture.height) {
+    Level base;
+    base.width = width;
+    base.height = height;
+    base.min_alpha.assign(alpha_texture.begin(), alpha_texture.end());
+    base.max_alpha = base.min_alpha;
+    levels.emplace_back(std::move(base));
+
+    while (levels.back().width > 1 || levels.back().height > 1) {
+        const Level &prev = levels.back();
+        Level level;
+        level.width = (prev.width + 1) / 2;
+        level.height = (prev.height + 1) / 2;
+        level.min_alpha.resize(level.width * level.height);
+        level.max_alpha.resize(level.width * level.height);
+
+        for (size_t y = 0; y < level.height; y++) {
+            for (size_t x = 0; x < level.width; x++) {
+                float min_alpha = 1.f;
+                float max_alpha = 0.f;
+                // children, clamped at the odd borders
+                size_t max_cx = std::min(x * 2 + 1, prev.width - 1);
+                size_t max_cy = std::min(y * 2 + 1, prev.height - 1);
+                for (size_t cy = y * 2; cy <= max_cy; cy++) {
+                    for (size_t cx = x * 2; cx <= max_cx; cx++) {
+                        size_t child = cy * prev.width + cx;
+                        min_alpha = std::min(min_alpha, prev.min_alpha[child]);
+                        max_alpha = std::max(max_alpha, prev.max_alpha[child]);
+                    }
+                }
+                level.min_alpha[y * level.width + x] = min_alpha;
+                level.max_alpha[y * level.width + x] = max_alpha;
+            }
+        }
+        levels.emplace_back(std::move(level));
+    }
+}
+
+AlphaHierarchy::Coverage AlphaHierarchy::classify(const vec2 &min_uv,
+                                                  const vec2 &max_uv) const {
+    if (width == 0 || height == 0) return MIXED;
+
+    float min_alpha = 1.f;
+    float max_alpha = 0.f;
+    for (auto [x0, x1] : texel_ranges(min_uv.x(), max_uv.x(), width, false)) {
+        for (auto [y0, y1] :
+             texel_ranges(min_uv.y(), max_uv.y(), height, true)) {
+            auto [range_min, range_max] = min_max(x0, y0, x1, y1);
+            min_alpha = std::min(min_alpha, range_min);
+            max_alpha = std::max(max_alpha, range_max);
+        }
+    }
+
+    if (min_alpha >= EPS) return OPAQUE;
+    if (max_alpha < EPS) return TRANSPARENT;
+    return MIXED;
+}
+
+std::vector<std::pair<size_t, size_t>> AlphaHierarchy::texel_ranges(
+    float min_t, float max_t, const size_t size, const bool flip) {
+    // wrap into [0, 1], splitting the range at the border
+    std::vector<std::pair<float, float>> wrapped;
+    if (!(max_t - min_t < 1.f)) {  // also for nan
+        wrapped.emplace_back(0.f, 1.f);
+    } else {
+        float begin = min_t - std::floor(min_t);
+        float end = begin + (max_t - min_t);
+        if (end < 1.f) {
+            wrapped.emplace_back(begin, end);
+        } else {
+            wrapped.emplace_back(begin, 1.f);
+            wrapped.emplace_back(0.f, end - 1.f);
+        }
+    }
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (auto [begin, end] : wrapped) {
+        if (flip) {
+            std::tie(begin, end) = std::make_pair(1.f - end, 1.f - begin);
+        }
+        // one texel more on each side for the bilinear footprint and the
+        // rounding
+        float first = std::floor(begin * size - 0.5f) - 1.f;
+        float last = std::floor(end * size - 0.5f) + 2.f;
+        first = std::clamp(first, 0.f, size - 1.f);
+        last = std::clamp(last, 0.f, size - 1.f);
+        ranges.emplace_back(first, last);
+    }
+    return ranges;
+}
+
+std::tuple<float, float> AlphaHierarchy::min_max(const size_t x0,
+                                                 const size_t y0,
+                                                 const size_t x1,
+                                                 const size_t y1) const {
+    // the lowest level where the range spans at most 2 x 2 nodes
+    size_t lod = 0;
+    while (lod + 1 < levels.size() &&
+           ((x1 >> lod) - (x0 >> lod) > 1 || (y1 >> lod) - (y0 >> lod) > 1)) {
+        lod++;
+    }
+
+    const Level &level = levels[lod];
+    float min_alpha = 1.f;
+    float max_alpha = 0.f;
+    for (size_t y = y0 >> lod; y <= (y1 >> lod); y++) {
+        for (size_t x = x0 >> lod; x <= (x1 >> lod); x++) {
+            size_t node = y * level.width + x;
+            min_alpha = std::min(min_alpha, level.min_alpha[node]);
+            max_alpha = std::max(max_alpha, level.max_alpha[node]);
+        }
+    }
+    return std::make_tuple(min_alpha, max_alpha);
+}
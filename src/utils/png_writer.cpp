@@ -0,0 +1,137 @@
+#include "utils/png_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+
+#include "utils/functions.hpp"
+
+namespace {
+
+// maximum size of a stored deflate block
+const size_t MAX_BLOCK_SIZE = 65535;
+
+void append_u32(std::vector<uint8_t> *data, const uint32_t val) {
+    data->push_back(val >> 24);
+    data->push_back(val >> 16);
+    data->push_back(val >> 8);
+    data->push_back(val);
+}
+
+uint32_t crc32(const char *type, const std::vector<uint8_t> &data) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> table;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (size_t k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < 4; i++) {
+        crc = table[(crc ^ static_cast<uint8_t>(type[i])) & 0xff] ^ (crc >> 8);
+    }
+    for (uint8_t byte : data) {
+        crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+}  // namespace
+
+PngWriter::PngWriter(const std::string &filename, const size_t width,
+                     const size_t height)
+    : file(filename, std::ios::binary), width(width), height(height) {
+    if (!file) {
+        std::cerr << "Open image failed: " << filename << std::endl;
+        return;
+    }
+
+    const char signature[] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+    file.write(signature, sizeof(signature));
+
+    std::vector<uint8_t> header;
+    append_u32(&header, width);
+    append_u32(&header, height);
+    header.push_back(8);  // bit depth
+    header.push_back(2);  // color type: RGB
+    header.push_back(0);  // compression method
+    header.push_back(0);  // filter method
+    header.push_back(0);  // interlace method
+    write_chunk("IHDR", header);
+}
+
+void PngWriter::write_rows(const Texture<vec3> &texture,
+                           const size_t first_row, const size_t rows_num,
+                           const bool linear) {
+    // scanlines, each with the filter type "none"
+    size_t row_size = width * 3 + 1;
+    std::vector<uint8_t> scanlines(row_size * rows_num);
+#pragma omp parallel for
+    for (size_t y = 0; y < rows_num; y++) {
+        uint8_t *scanline = &scanlines[y * row_size];
+        scanline[0] = 0;
+        for (size_t x = 0; x < width; x++) {
+            vec3 t = texture.at(x, first_row + y);
+            if (!linear) t = gamma_correction(t, 1.f / 2.2f);
+            t *= 255.f;
+            for (size_t j = 0; j < 3; j++) {
+                scanline[1 + x * 3 + j] = static_cast<uint8_t>(
+                    std::clamp(std::lrint(t[j]), 0l, 255l));
+            }
+        }
+    }
+
+    for (uint8_t byte : scanlines) {
+        adler_a = (adler_a + byte) % 65521;
+        adler_b = (adler_b + adler_a) % 65521;
+    }
+
+    // zlib stream of stored deflate blocks, split into one IDAT chunk per call
+    std::vector<uint8_t> data;
+    if (rows_written == 0) {
+        data.push_back(0x78);
+        data.push_back(0x01);
+    }
+    rows_written += rows_num;
+    bool last = rows_written >= height;
+    for (size_t begin = 0; begin < scanlines.size();
+         begin += MAX_BLOCK_SIZE) {
+        size_t size = std::min(MAX_BLOCK_SIZE, scanlines.size() - begin);
+        bool final_block = last && begin + size == scanlines.size();
+        data.push_back(final_block ? 1 : 0);
+        data.push_back(size & 0xff);
+        data.push_back(size >> 8);
+        data.push_back(~size & 0xff);
+        data.push_back((~size >> 8) & 0xff);
+        data.insert(data.end(), scanlines.begin() + begin,
+                    scanlines.begin() + begin + size);
+    }
+    if (last) {
+        append_u32(&data, (adler_b << 16) | adler_a);
+    }
+    write_chunk("IDAT", data);
+
+    if (last) {
+        write_chunk("IEND", {});
+        file.close();
+    }
+}
+
+void PngWriter::write_chunk(const char *type,
+                            const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> length;
+    append_u32(&length, data.size());
+    file.write(reinterpret_cast<const char *>(length.data()), length.size());
+    file.write(type, 4);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+
+    std::vector<uint8_t> crc;
+    append_u32(&crc, crc32(type, data));
+    file.write(reinterpret_cast<const char *>(crc.data()), crc.size());
+}
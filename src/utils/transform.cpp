@@ -16,6 +16,8 @@ vec3 DirectionTransform::transform(const vec3 &pos) const {
     return matrix * pos;
 }
 
+const mat3 &DirectionTransform::get_matrix() const { return matrix; }
+
 void DirectionTransform::rotation(const vec3 &angle_deg) {
     vec3 angle_arc = angle_deg * M_PI / 180.f;
     float sin_x = std::sin(angle_arc.x());
@@ -69,6 +71,8 @@ vec4 PositionTransform::transform(const vec4 &pos) const {
     return matrix * pos;
 }
 
+const mat4 &PositionTransform::get_matrix() const { return matrix; }
+
 void PositionTransform::translation(const vec3 &dist) {
     mat4 trans_matrix;
     // clang-format off
@@ -168,11 +172,12 @@ void PositionTransform::view_to_ndc(const Camera &camera) {
 
 void PositionTransform::ndc_to_screen(const Camera &camera) {
     // x: [-1, 1] -> [0, width]
-    // y: [-1, 1] -> [0, height]
+    // y: [-1, 1] -> [0, frame_height]
     // z: [-1, 1] -> [0, 1]
+    // The offset of a band camera is applied by VertexShader.
 
     float screen_scale_x = static_cast<float>(camera.width) / 2.f;
-    float screen_scale_y = static_cast<float>(camera.height) / 2.f;
+    float screen_scale_y = static_cast<float>(camera.frame_height) / 2.f;
 
     mat4 screen_transform;
 